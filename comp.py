@@ -37,11 +37,33 @@ def main():
         link = None
 
     dynamic_string = Object("dynamic_string.obj", "src/dynamic_string.c")
-
-    Executable("main", "src/main.c", dynamic_string, 
-               packages=[sdl3, sdl3_image], extra_link_flags=link)
-    Executable("cam", "src/cam.cpp", dynamic_string,
+    downsample = Object("downsample.obj", "src/downsample.c")
+    ansi = Object("ansi.obj", "src/ansi.c")
+    encode = Object("encode.obj", "src/encode.c")
+    workpool = Object("workpool.obj", "src/workpool.c")
+    gif = Object("gif.obj", "src/gif.c")
+    pacer = Object("pacer.obj", "src/pacer.c")
+    quality = Object("quality.obj", "src/quality.c")
+    palette = Object("palette.obj", "src/palette.c")
+    render = Object("render.obj", "src/render.c")
+    latency = Object("latency.obj", "src/latency.c")
+    hysteresis = Object("hysteresis.obj", "src/hysteresis.c")
+
+    Executable("main", "src/main.c", dynamic_string, downsample, ansi, encode,
+               workpool, gif, pacer, quality, palette, render, packages=[sdl3, sdl3_image], extra_link_flags=link)
+    Executable("cam", "src/cam.cpp", dynamic_string, downsample, ansi, encode,
+               workpool, pacer, quality, palette, render, latency, hysteresis,
                packages=[opencv])
+    Executable("test_downsample", "src/test_downsample.c", downsample,
+               group="test")
+    Executable("test_yuv", "src/test_yuv.c", dynamic_string, downsample, ansi,
+               encode, workpool, palette, render, group="test")
+    Executable("test_hysteresis", "src/test_hysteresis.c", dynamic_string,
+               ansi, encode, workpool, palette, hysteresis, group="test")
+    Executable("test_encode", "src/test_encode.c", dynamic_string, ansi,
+               encode, workpool, palette, group="test")
+    Executable("bench_encode", "src/bench_encode.c", dynamic_string, ansi,
+               encode, workpool, palette, group="bench")
 
     CopyToBin(*sdl3.dlls, *sdl3_image.dlls, *opencv.dlls)
 
@@ -0,0 +1,194 @@
+#include <string.h>
+
+#include "ansi.h"
+
+// Decimal digits of every byte value, the last entry is the digit count
+static const char decimal[256][4] = {
+    {'0',0,0,1}, {'1',0,0,1}, {'2',0,0,1}, {'3',0,0,1}, {'4',0,0,1},
+    {'5',0,0,1}, {'6',0,0,1}, {'7',0,0,1}, {'8',0,0,1}, {'9',0,0,1},
+    {'1','0',0,2}, {'1','1',0,2}, {'1','2',0,2}, {'1','3',0,2}, {'1','4',0,2},
+    {'1','5',0,2}, {'1','6',0,2}, {'1','7',0,2}, {'1','8',0,2}, {'1','9',0,2},
+    {'2','0',0,2}, {'2','1',0,2}, {'2','2',0,2}, {'2','3',0,2}, {'2','4',0,2},
+    {'2','5',0,2}, {'2','6',0,2}, {'2','7',0,2}, {'2','8',0,2}, {'2','9',0,2},
+    {'3','0',0,2}, {'3','1',0,2}, {'3','2',0,2}, {'3','3',0,2}, {'3','4',0,2},
+    {'3','5',0,2}, {'3','6',0,2}, {'3','7',0,2}, {'3','8',0,2}, {'3','9',0,2},
+    {'4','0',0,2}, {'4','1',0,2}, {'4','2',0,2}, {'4','3',0,2}, {'4','4',0,2},
+    {'4','5',0,2}, {'4','6',0,2}, {'4','7',0,2}, {'4','8',0,2}, {'4','9',0,2},
+    {'5','0',0,2}, {'5','1',0,2}, {'5','2',0,2}, {'5','3',0,2}, {'5','4',0,2},
+    {'5','5',0,2}, {'5','6',0,2}, {'5','7',0,2}, {'5','8',0,2}, {'5','9',0,2},
+    {'6','0',0,2}, {'6','1',0,2}, {'6','2',0,2}, {'6','3',0,2}, {'6','4',0,2},
+    {'6','5',0,2}, {'6','6',0,2}, {'6','7',0,2}, {'6','8',0,2}, {'6','9',0,2},
+    {'7','0',0,2}, {'7','1',0,2}, {'7','2',0,2}, {'7','3',0,2}, {'7','4',0,2},
+    {'7','5',0,2}, {'7','6',0,2}, {'7','7',0,2}, {'7','8',0,2}, {'7','9',0,2},
+    {'8','0',0,2}, {'8','1',0,2}, {'8','2',0,2}, {'8','3',0,2}, {'8','4',0,2},
+    {'8','5',0,2}, {'8','6',0,2}, {'8','7',0,2}, {'8','8',0,2}, {'8','9',0,2},
+    {'9','0',0,2}, {'9','1',0,2}, {'9','2',0,2}, {'9','3',0,2}, {'9','4',0,2},
+    {'9','5',0,2}, {'9','6',0,2}, {'9','7',0,2}, {'9','8',0,2}, {'9','9',0,2},
+    {'1','0','0',3}, {'1','0','1',3}, {'1','0','2',3}, {'1','0','3',3},
+    {'1','0','4',3}, {'1','0','5',3}, {'1','0','6',3}, {'1','0','7',3},
+    {'1','0','8',3}, {'1','0','9',3}, {'1','1','0',3}, {'1','1','1',3},
+    {'1','1','2',3}, {'1','1','3',3}, {'1','1','4',3}, {'1','1','5',3},
+    {'1','1','6',3}, {'1','1','7',3}, {'1','1','8',3}, {'1','1','9',3},
+    {'1','2','0',3}, {'1','2','1',3}, {'1','2','2',3}, {'1','2','3',3},
+    {'1','2','4',3}, {'1','2','5',3}, {'1','2','6',3}, {'1','2','7',3},
+    {'1','2','8',3}, {'1','2','9',3}, {'1','3','0',3}, {'1','3','1',3},
+    {'1','3','2',3}, {'1','3','3',3}, {'1','3','4',3}, {'1','3','5',3},
+    {'1','3','6',3}, {'1','3','7',3}, {'1','3','8',3}, {'1','3','9',3},
+    {'1','4','0',3}, {'1','4','1',3}, {'1','4','2',3}, {'1','4','3',3},
+    {'1','4','4',3}, {'1','4','5',3}, {'1','4','6',3}, {'1','4','7',3},
+    {'1','4','8',3}, {'1','4','9',3}, {'1','5','0',3}, {'1','5','1',3},
+    {'1','5','2',3}, {'1','5','3',3}, {'1','5','4',3}, {'1','5','5',3},
+    {'1','5','6',3}, {'1','5','7',3}, {'1','5','8',3}, {'1','5','9',3},
+    {'1','6','0',3}, {'1','6','1',3}, {'1','6','2',3}, {'1','6','3',3},
+    {'1','6','4',3}, {'1','6','5',3}, {'1','6','6',3}, {'1','6','7',3},
+    {'1','6','8',3}, {'1','6','9',3}, {'1','7','0',3}, {'1','7','1',3},
+    {'1','7','2',3}, {'1','7','3',3}, {'1','7','4',3}, {'1','7','5',3},
+    {'1','7','6',3}, {'1','7','7',3}, {'1','7','8',3}, {'1','7','9',3},
+    {'1','8','0',3}, {'1','8','1',3}, {'1','8','2',3}, {'1','8','3',3},
+    {'1','8','4',3}, {'1','8','5',3}, {'1','8','6',3}, {'1','8','7',3},
+    {'1','8','8',3}, {'1','8','9',3}, {'1','9','0',3}, {'1','9','1',3},
+    {'1','9','2',3}, {'1','9','3',3}, {'1','9','4',3}, {'1','9','5',3},
+    {'1','9','6',3}, {'1','9','7',3}, {'1','9','8',3}, {'1','9','9',3},
+    {'2','0','0',3}, {'2','0','1',3}, {'2','0','2',3}, {'2','0','3',3},
+    {'2','0','4',3}, {'2','0','5',3}, {'2','0','6',3}, {'2','0','7',3},
+    {'2','0','8',3}, {'2','0','9',3}, {'2','1','0',3}, {'2','1','1',3},
+    {'2','1','2',3}, {'2','1','3',3}, {'2','1','4',3}, {'2','1','5',3},
+    {'2','1','6',3}, {'2','1','7',3}, {'2','1','8',3}, {'2','1','9',3},
+    {'2','2','0',3}, {'2','2','1',3}, {'2','2','2',3}, {'2','2','3',3},
+    {'2','2','4',3}, {'2','2','5',3}, {'2','2','6',3}, {'2','2','7',3},
+    {'2','2','8',3}, {'2','2','9',3}, {'2','3','0',3}, {'2','3','1',3},
+    {'2','3','2',3}, {'2','3','3',3}, {'2','3','4',3}, {'2','3','5',3},
+    {'2','3','6',3}, {'2','3','7',3}, {'2','3','8',3}, {'2','3','9',3},
+    {'2','4','0',3}, {'2','4','1',3}, {'2','4','2',3}, {'2','4','3',3},
+    {'2','4','4',3}, {'2','4','5',3}, {'2','4','6',3}, {'2','4','7',3},
+    {'2','4','8',3}, {'2','4','9',3}, {'2','5','0',3}, {'2','5','1',3},
+    {'2','5','2',3}, {'2','5','3',3}, {'2','5','4',3}, {'2','5','5',3}
+};
+
+static inline char* write_u8(char* dest, uint8_t v) {
+    memcpy(dest, decimal[v], 4);
+    return dest + decimal[v][3];
+}
+
+static inline char* write_rgb(char* dest, const char* prefix, uint8_t r,
+                              uint8_t g, uint8_t b) {
+    memcpy(dest, prefix, 7);
+    dest = write_u8(dest + 7, r);
+    *dest++ = ';';
+    dest = write_u8(dest, g);
+    *dest++ = ';';
+    dest = write_u8(dest, b);
+    *dest++ = 'm';
+    return dest;
+}
+
+char* ansi_fg_rgb(char* dest, uint8_t r, uint8_t g, uint8_t b) {
+    return write_rgb(dest, "\x1b[38;2;", r, g, b);
+}
+
+char* ansi_bg_rgb(char* dest, uint8_t r, uint8_t g, uint8_t b) {
+    return write_rgb(dest, "\x1b[48;2;", r, g, b);
+}
+
+static inline char* write_index(char* dest, const char* prefix, uint8_t n) {
+    memcpy(dest, prefix, 7);
+    dest = write_u8(dest + 7, n);
+    *dest++ = 'm';
+    return dest;
+}
+
+char* ansi_fg_256(char* dest, uint8_t n) {
+    return write_index(dest, "\x1b[38;5;", n);
+}
+
+char* ansi_bg_256(char* dest, uint8_t n) {
+    return write_index(dest, "\x1b[48;5;", n);
+}
+
+char* ansi_fg_16(char* dest, uint8_t n) {
+    memcpy(dest, n < 8 ? "\x1b[30m" : "\x1b[90m", 5);
+    dest[3] += n & 7;
+    return dest + 5;
+}
+
+char* ansi_bg_16(char* dest, uint8_t n) {
+    if (n < 8) {
+        memcpy(dest, "\x1b[40m", 5);
+        dest[3] += n;
+        return dest + 5;
+    }
+    memcpy(dest, "\x1b[100m", 6);
+    dest[4] += n - 8;
+    return dest + 6;
+}
+
+char* ansi_uint(char* dest, uint32_t n) {
+    if (n < 256) {
+        return write_u8(dest, n);
+    }
+    char buf[10];
+    uint32_t len = 0;
+    while (n > 0) {
+        buf[len++] = '0' + n % 10;
+        n /= 10;
+    }
+    for (uint32_t i = 0; i < len; ++i) {
+        dest[i] = buf[len - i - 1];
+    }
+    return dest + len;
+}
+
+uint32_t ansi_uint_len(uint32_t n) {
+    uint32_t len = 1;
+    while (n >= 10) {
+        n /= 10;
+        ++len;
+    }
+    return len;
+}
+
+char* ansi_cup(char* dest, uint32_t row, uint32_t col) {
+    *dest++ = '\x1b';
+    *dest++ = '[';
+    dest = ansi_uint(dest, row);
+    *dest++ = ';';
+    dest = ansi_uint(dest, col);
+    *dest++ = 'H';
+    return dest;
+}
+
+char* ansi_cuf(char* dest, uint32_t n) {
+    *dest++ = '\x1b';
+    *dest++ = '[';
+    dest = ansi_uint(dest, n);
+    *dest++ = 'C';
+    return dest;
+}
+
+char* ansi_rep(char* dest, uint32_t n) {
+    *dest++ = '\x1b';
+    *dest++ = '[';
+    dest = ansi_uint(dest, n);
+    *dest++ = 'b';
+    return dest;
+}
+
+bool ansi_append_fg_rgb(String* s, uint8_t r, uint8_t g, uint8_t b) {
+    if (!String_reserve(s, s->length + ANSI_SGR_RGB_MAX + ANSI_SLACK)) {
+        return false;
+    }
+    char* end = ansi_fg_rgb(s->buffer + s->length, r, g, b);
+    s->length = end - s->buffer;
+    s->buffer[s->length] = '\0';
+    return true;
+}
+
+bool ansi_append_bg_rgb(String* s, uint8_t r, uint8_t g, uint8_t b) {
+    if (!String_reserve(s, s->length + ANSI_SGR_RGB_MAX + ANSI_SLACK)) {
+        return false;
+    }
+    char* end = ansi_bg_rgb(s->buffer + s->length, r, g, b);
+    s->length = end - s->buffer;
+    s->buffer[s->length] = '\0';
+    return true;
+}
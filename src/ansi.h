@@ -0,0 +1,102 @@
+#ifndef ANSI_H_00
+#define ANSI_H_00
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dynamic_string.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Length of the longest SGR color sequence, "\x1b[38;2;255;255;255m"
+#define ANSI_SGR_RGB_MAX 19
+
+// The raw writers may touch this many bytes past the returned pointer
+#define ANSI_SLACK 3
+
+// Longest encoding of one cell: fg and bg sequences and a 3 byte glyph
+#define ANSI_CELL_MAX (2 * ANSI_SGR_RGB_MAX + 3)
+
+// Upper bound on the bytes needed to encode `rows` rows of `cols` cells,
+// each row adding a `row_extra` byte terminator, plus `extra` bytes.
+// Includes ANSI_SLACK, so raw writers can be used without further checks.
+static inline uint64_t ansi_frame_bound(uint32_t cols, uint32_t rows,
+                                        uint32_t row_extra, uint32_t extra) {
+    return (uint64_t)rows * ((uint64_t)cols * ANSI_CELL_MAX + row_extra) +
+           extra + ANSI_SLACK;
+}
+
+// Write "\x1b[38;2;R;G;Bm" to `dest`.
+// `dest` must have room for ANSI_SGR_RGB_MAX + ANSI_SLACK bytes.
+// Returns a pointer past the last written byte.
+char* ansi_fg_rgb(char* dest, uint8_t r, uint8_t g, uint8_t b);
+
+// Write "\x1b[48;2;R;G;Bm" to `dest`. See ansi_fg_rgb.
+char* ansi_bg_rgb(char* dest, uint8_t r, uint8_t g, uint8_t b);
+
+// Number of decimal digits in `v`
+static inline uint32_t ansi_u8_len(uint8_t v) {
+    return 1 + (v >= 10) + (v >= 100);
+}
+
+// Length of the sequence written by ansi_fg_rgb or ansi_bg_rgb
+static inline uint32_t ansi_rgb_len(uint8_t r, uint8_t g, uint8_t b) {
+    return 10 + ansi_u8_len(r) + ansi_u8_len(g) + ansi_u8_len(b);
+}
+
+// Write "\x1b[38;5;Nm", selecting entry `n` of the 256 color palette.
+// See ansi_fg_rgb.
+char* ansi_fg_256(char* dest, uint8_t n);
+
+// Write "\x1b[48;5;Nm". See ansi_fg_256.
+char* ansi_bg_256(char* dest, uint8_t n);
+
+// Length of the sequence written by ansi_fg_256 or ansi_bg_256
+static inline uint32_t ansi_256_len(uint8_t n) {
+    return 8 + ansi_u8_len(n);
+}
+
+// Write "\x1b[3Nm", or "\x1b[9Nm" for the bright colors 8-15, selecting
+// one of the 16 basic colors. See ansi_fg_rgb.
+char* ansi_fg_16(char* dest, uint8_t n);
+
+// Write "\x1b[4Nm", or "\x1b[10Nm" for the bright colors. See ansi_fg_16.
+char* ansi_bg_16(char* dest, uint8_t n);
+
+// Length of the sequence written by ansi_fg_16 or ansi_bg_16
+static inline uint32_t ansi_fg_16_len(uint8_t n) {
+    (void)n;
+    return 5;
+}
+
+static inline uint32_t ansi_bg_16_len(uint8_t n) {
+    return n < 8 ? 5 : 6;
+}
+
+// Write `n` in decimal to `dest`. Returns a pointer past the last digit.
+char* ansi_uint(char* dest, uint32_t n);
+
+// Number of decimal digits in `n`
+uint32_t ansi_uint_len(uint32_t n);
+
+// Write "\x1b[ROW;COLH", moving the cursor to 1-based `row` and `col`
+char* ansi_cup(char* dest, uint32_t row, uint32_t col);
+
+// Write "\x1b[NC", moving the cursor `n` columns forward
+char* ansi_cuf(char* dest, uint32_t n);
+
+// Write "\x1b[Nb", repeating the last written character `n` times
+char* ansi_rep(char* dest, uint32_t n);
+
+// Append "\x1b[38;2;R;G;Bm" to string
+bool ansi_append_fg_rgb(String* s, uint8_t r, uint8_t g, uint8_t b);
+
+// Append "\x1b[48;2;R;G;Bm" to string
+bool ansi_append_bg_rgb(String* s, uint8_t r, uint8_t g, uint8_t b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,341 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "encode.h"
+#include "palette.h"
+
+// Encodes a generated corpus of frames and prints the bytes written per
+// frame and the color error the terminal ends up showing, for a range of
+// color tolerances. The greedy column encodes each cell in turn instead
+// of searching each row for the shortest sequence. A higher tolerance
+// must never write more bytes, the exit status is 1 if it does.
+// Usage: bench_encode [frames] [cols] [rows]
+
+#define CORPUS_KINDS 3
+
+static const char* const CORPUS_NAMES[CORPUS_KINDS] = {
+    "photo", "gradient", "ui"
+};
+
+static const uint32_t TOLERANCES[] = {0, 1, 2, 4, 6, 8, 12, 16, 24, 32};
+
+#define TOLERANCE_COUNT (sizeof(TOLERANCES) / sizeof(TOLERANCES[0]))
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+static uint8_t clamp(double v) {
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+}
+
+// Smooth shapes with a little sensor noise, slowly moving
+static void gen_photo(uint8_t* px, uint32_t w, uint32_t h, uint32_t frame) {
+    double t = frame * 0.15;
+    for (uint32_t y = 0; y < h; ++y) {
+        for (uint32_t x = 0; x < w; ++x, px += 4) {
+            double u = (double)x / w, v = (double)y / h;
+            double r = 128 + 90 * sin(6 * u + t) * cos(4 * v - t);
+            double g = 110 + 70 * sin(5 * v + 3 * u + 0.7 * t);
+            double b = 100 + 80 * cos(7 * u * v + t) + 40 * v;
+            double n = (double)(rng() % 9) - 4;
+            px[0] = clamp(r + n);
+            px[1] = clamp(g + n);
+            px[2] = clamp(b + n);
+            px[3] = 0xff;
+        }
+    }
+}
+
+// A dithered diagonal gradient, scrolling
+static void gen_gradient(uint8_t* px, uint32_t w, uint32_t h, uint32_t frame) {
+    for (uint32_t y = 0; y < h; ++y) {
+        for (uint32_t x = 0; x < w; ++x, px += 4) {
+            double d = (double)(x + 2 * y + 3 * frame) / (w + 2 * h);
+            double n = (double)(rng() % 3) - 1;
+            px[0] = clamp(40 + 180 * d + n);
+            px[1] = clamp(200 - 120 * d + n);
+            px[2] = clamp(90 + 60 * d + n);
+            px[3] = 0xff;
+        }
+    }
+}
+
+// Flat panels and lines of "text" in a handful of colors, some of them
+// palette entries, with a moving cursor block
+static void gen_ui(uint8_t* px, uint32_t w, uint32_t h, uint32_t frame) {
+    static const uint8_t colors[5][3] = {
+        {30, 30, 30}, {238, 238, 238}, {0, 95, 175}, {215, 95, 0}, {40, 44, 52}
+    };
+    for (uint32_t y = 0; y < h; ++y) {
+        for (uint32_t x = 0; x < w; ++x, px += 4) {
+            uint32_t c = x < w / 4 ? 4 : y < h / 8 ? 2 : 0;
+            if (c == 0 && y % 4 < 2 && (x * 7 + y * 3) % 11 < 7 &&
+                x % 40 < 10 + (y * 13) % 27) {
+                c = 1;
+            }
+            if (c == 0 && y / 4 == frame % (h / 4) && x % 40 == 12) {
+                c = 3;
+            }
+            memcpy(px, colors[c], 3);
+            px[3] = 0xff;
+        }
+    }
+}
+
+static void gen_frame(uint32_t kind, uint8_t* px, uint32_t w, uint32_t h,
+                      uint32_t frame) {
+    if (kind == 0) {
+        gen_photo(px, w, h, frame);
+    } else if (kind == 1) {
+        gen_gradient(px, w, h, frame);
+    } else {
+        gen_ui(px, w, h, frame);
+    }
+}
+
+// What a terminal shows: the color of each half of each cell
+typedef struct Screen {
+    uint32_t* top;
+    uint32_t* bottom;
+    uint32_t cols;
+    uint32_t rows;
+} Screen;
+
+static uint32_t parse_uint(const char** s) {
+    uint32_t n = 0;
+    while (**s >= '0' && **s <= '9') {
+        n = 10 * n + (uint32_t)(*(*s)++ - '0');
+    }
+    return n;
+}
+
+static uint32_t palette_color(uint32_t n) {
+    return CELL_RGB(palette_rgb[n][0], palette_rgb[n][1], palette_rgb[n][2]);
+}
+
+// Apply the parameters of an SGR sequence, up to the final 'm'
+static void parse_sgr(const char** s, uint32_t* fg, uint32_t* bg) {
+    while (**s != 'm') {
+        uint32_t p = parse_uint(s);
+        uint32_t* target = p == 38 ? fg : bg;
+        if (p == 38 || p == 48) {
+            ++*s;
+            uint32_t mode = parse_uint(s);
+            ++*s;
+            if (mode == 5) {
+                *target = palette_color(parse_uint(s));
+            } else {
+                uint32_t r = parse_uint(s);
+                ++*s;
+                uint32_t g = parse_uint(s);
+                ++*s;
+                *target = CELL_RGB(r, g, parse_uint(s));
+            }
+        } else if (p == 0) {
+            *fg = CELL_RGB(255, 255, 255);
+            *bg = 0;
+        } else if (p == 49) {
+            *bg = 0;
+        } else if (p >= 30 && p <= 37) {
+            *fg = palette_color(p - 30);
+        } else if (p >= 40 && p <= 47) {
+            *bg = palette_color(p - 40);
+        } else if (p >= 90 && p <= 97) {
+            *fg = palette_color(p - 82);
+        } else if (p >= 100 && p <= 107) {
+            *bg = palette_color(p - 92);
+        }
+        if (**s == ';') {
+            ++*s;
+        }
+    }
+    ++*s;
+}
+
+// Draw `glyph`, a space or a block element code point, at row, col
+static void set_cell(Screen* scr, uint32_t row, uint32_t col, uint32_t glyph,
+                     uint32_t fg, uint32_t bg) {
+    if (row >= scr->rows || col >= scr->cols) {
+        return;
+    }
+    uint32_t ix = row * scr->cols + col;
+    scr->top[ix] = glyph == ' ' || glyph == 0x2584 ? bg : fg;
+    scr->bottom[ix] = glyph == ' ' || glyph == 0x2580 ? bg : fg;
+}
+
+// Run the output of encode_frame through a minimal terminal
+static void screen_decode(Screen* scr, const char* s) {
+    uint32_t fg = CELL_RGB(255, 255, 255), bg = 0;
+    uint32_t row = 0, col = 0;
+    uint32_t glyph = ' ';
+    while (*s != '\0') {
+        if (*s == '\x1b') {
+            s += 2;
+            const char* params = s;
+            while ((*s >= '0' && *s <= '9') || *s == ';') {
+                ++s;
+            }
+            char cmd = *s++;
+            if (cmd == 'm') {
+                parse_sgr(&params, &fg, &bg);
+                continue;
+            }
+            uint32_t n = parse_uint(&params);
+            if (cmd == 'H') {
+                row = n - 1;
+                ++params;
+                col = parse_uint(&params) - 1;
+            } else if (cmd == 'C') {
+                col += n;
+            } else if (cmd == 'K') {
+                for (uint32_t x = col; row < scr->rows && x < scr->cols; ++x) {
+                    scr->top[row * scr->cols + x] = bg;
+                    scr->bottom[row * scr->cols + x] = bg;
+                }
+            } else if (cmd == 'b') {
+                for (uint32_t i = 0; i < n && col < scr->cols; ++i, ++col) {
+                    set_cell(scr, row, col, glyph, fg, bg);
+                }
+            }
+            continue;
+        }
+        if (*s == '\n') {
+            ++row;
+            col = 0;
+            ++s;
+            continue;
+        }
+        if (*s == ' ') {
+            glyph = ' ';
+            ++s;
+        } else {
+            // "\xe2\x96\x80", "\xe2\x96\x84" or "\xe2\x96\x88"
+            glyph = 0x2500 | (uint8_t)s[2];
+            s += 3;
+        }
+        set_cell(scr, row, col, glyph, fg, bg);
+        ++col;
+    }
+}
+
+// The "redmean" distance color_near in encode.c compares with the
+// tolerance, so an error of n is about a difference of n in every channel
+static double color_error(uint32_t a, uint32_t b) {
+    int32_t rmean = (CELL_R(a) + CELL_R(b)) / 2;
+    int32_t dr = CELL_R(a) - CELL_R(b);
+    int32_t dg = CELL_G(a) - CELL_G(b);
+    int32_t db = CELL_B(a) - CELL_B(b);
+    double d = (((512 + rmean) * dr * dr) >> 8) + 4 * dg * dg +
+               (((767 - rmean) * db * db) >> 8);
+    return sqrt(d / 9);
+}
+
+typedef struct Result {
+    uint64_t bytes;
+    double error_sum;
+    double error_max;
+    uint64_t pixels;
+} Result;
+
+static bool measure(Result* res, String* out, Screen* scr, const CellGrid* grid,
+                    const EncodeOptions* opts) {
+    String_clear(out);
+    if (!encode_frame(out, grid, opts)) {
+        return false;
+    }
+    res->bytes += out->length;
+    screen_decode(scr, out->buffer);
+    for (uint32_t i = 0; i < grid->cols * grid->rows; ++i) {
+        double e = color_error(grid->cells[i].top, scr->top[i]);
+        double e2 = color_error(grid->cells[i].bottom, scr->bottom[i]);
+        res->error_sum += e + e2;
+        res->error_max = e > res->error_max ? e : res->error_max;
+        res->error_max = e2 > res->error_max ? e2 : res->error_max;
+        res->pixels += 2;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    uint32_t frames = argc > 1 ? strtoul(argv[1], NULL, 10) : 16;
+    uint32_t cols = argc > 2 ? strtoul(argv[2], NULL, 10) : 160;
+    uint32_t rows = argc > 3 ? strtoul(argv[3], NULL, 10) : 45;
+    if (frames == 0 || cols == 0 || rows == 0) {
+        fprintf(stderr, "Usage: %s [frames] [cols] [rows]\n", argv[0]);
+        return 1;
+    }
+    palette_init();
+
+    uint32_t w = cols, h = 2 * rows;
+    uint8_t* px = malloc((size_t)w * h * 4);
+    CellGrid grid;
+    String out;
+    Screen scr = {malloc(cols * rows * sizeof(uint32_t)),
+                  malloc(cols * rows * sizeof(uint32_t)), cols, rows};
+    if (px == NULL || scr.top == NULL || scr.bottom == NULL ||
+        !CellGrid_create(&grid, cols, rows) || !String_create(&out)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    printf("%u frames of %ux%u cells\n", frames, cols, rows);
+    bool monotonic = true;
+    for (uint32_t kind = 0; kind < CORPUS_KINDS; ++kind) {
+        Result results[TOLERANCE_COUNT];
+        Result greedy[TOLERANCE_COUNT];
+        memset(results, 0, sizeof(results));
+        memset(greedy, 0, sizeof(greedy));
+        rng_state = 1 + kind;
+        for (uint32_t f = 0; f < frames; ++f) {
+            gen_frame(kind, px, w, h, f);
+            CellGrid_from_rgba(&grid, px, h);
+            for (uint32_t t = 0; t < TOLERANCE_COUNT; ++t) {
+                EncodeOptions opts = {0};
+                opts.tolerance = TOLERANCES[t];
+                bool ok = measure(&results[t], &out, &scr, &grid, &opts);
+                opts.greedy = true;
+                ok = ok && measure(&greedy[t], &out, &scr, &grid, &opts);
+                if (!ok) {
+                    fprintf(stderr, "Encoding failed\n");
+                    return 1;
+                }
+            }
+        }
+        printf("\n%s\n%9s %12s %8s %8s %8s %10s %10s\n", CORPUS_NAMES[kind],
+               "tolerance", "bytes/frame", "greedy", "saved", "ratio",
+               "mean err", "max err");
+        double base = (double)results[0].bytes / frames;
+        for (uint32_t t = 0; t < TOLERANCE_COUNT; ++t) {
+            double bytes = (double)results[t].bytes / frames;
+            double greedy_bytes = (double)greedy[t].bytes / frames;
+            printf("%9u %12.0f %8.0f %7.1f%% %8.2f %10.2f %10.2f\n",
+                   TOLERANCES[t], bytes, greedy_bytes,
+                   100 * (greedy_bytes - bytes) / greedy_bytes, base / bytes,
+                   results[t].error_sum / results[t].pixels,
+                   results[t].error_max);
+        }
+        uint32_t rises = 0;
+        for (uint32_t t = 1; t < TOLERANCE_COUNT; ++t) {
+            rises += results[t].bytes > results[t - 1].bytes;
+        }
+        printf("%9s %12s\n", "rises", rises == 0 ? "never" : "yes");
+        monotonic = monotonic && rises == 0;
+    }
+
+    String_free(&out);
+    CellGrid_free(&grid);
+    free(scr.top);
+    free(scr.bottom);
+    free(px);
+    return monotonic ? 0 : 1;
+}
@@ -5,15 +5,36 @@
 #include <string>
 #include <vector>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <csignal>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#ifdef _WIN32
 #include <windows.h>
 #include <Dshow.h>
 #include <dvdmedia.h>
 #include <wmcodecdsp.h>
+#else
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
 
 #include "dynamic_string.h"
+#include "encode.h"
+#include "render.h"
+#include "downsample.h"
+#include "pacer.h"
+#include "quality.h"
+#include "palette.h"
+#include "latency.h"
+#include "hysteresis.h"
 
 
-
+#ifdef _WIN32
 void DeleteMediaType(AM_MEDIA_TYPE* pmt) {
     if (pmt)
     {
@@ -397,75 +418,29 @@ std::vector<CaptureDevice> FindCaptureDevices() {
 
     return res;
 }
+#endif
 
-void sample_pixel(int x, int y, const cv::Mat& mat, uint8_t& r, 
-                  uint8_t &g, uint8_t &b) {
-    r = mat.at<cv::Vec3b>(y, x)[2];
-    g = mat.at<cv::Vec3b>(y, x)[1];
-    b = mat.at<cv::Vec3b>(y, x)[0];
-}
-
-void convert_frame(RefString& dest, const cv::Mat& mat) {
-    int pw = mat.cols;
-    int ph = mat.rows;
-    ph = (ph + 1) / 2;
-
-    for (uint32_t y = 0; y < ph; ++y) {
-        uint32_t last_rgb1 = 0xffffffff, last_rgb2 = 0xffffffff;
-        for (uint32_t x = 0; x < pw; ++x) {
-            uint8_t r1, g1, b1;
-            uint8_t r2 = 0, g2 = 0, b2 = 0;
-            sample_pixel(x, 2 * y, mat, r1, g1, b1);
-            if ((2 * y + 1) < mat.rows) {
-                sample_pixel(x, (2 * y + 1), mat, r2, g2, b2);
-            }
-            uint32_t rgb1 = r1 | (g1 << 8) | (b1 << 16);
-            uint32_t rgb2 = r2 | (g2 << 8) | (b2 << 16);
-            if (rgb1 == last_rgb1) {
-                if (rgb2 == last_rgb2) {
-                    if (rgb1 == rgb2) {
-                        String_append(dest, ' ');
-                    } else {
-                        String_append_count(dest,  "\xe2\x96\x80", 3);
-                    }
-                } else {
-                    if (rgb1 == rgb2) {
-                        String_format_append(dest, 
-                            "\x1b[48;2;%u;%u;%um ",
-                            (unsigned)r2, (unsigned)g2, (unsigned)b2);
-                    } else {
-                        String_format_append(dest, 
-                            "\x1b[48;2;%u;%u;%um\xe2\x96\x80",
-                            (unsigned)r2, (unsigned)g2, (unsigned)b2);
-                    }
-                }
-            } else if (rgb2 == last_rgb2) {
-                if (rgb1 == rgb2) {
-                    String_format_append(dest, 
-                        "\x1b[38;2;%u;%u;%um ",
-                        (unsigned)r1, (unsigned)g1, (unsigned)b1);
-                } else {
-                    String_format_append(dest, 
-                        "\x1b[38;2;%u;%u;%um\xe2\x96\x80",
-                        (unsigned)r1, (unsigned)g1, (unsigned)b1);
-                }
-            } else if (rgb1 == rgb2) {
-                String_format_append(dest, 
-                    "\x1b[38;2;%u;%u;%um\x1b[48;2;%u;%u;%um ",
-                    (unsigned)r1, (unsigned)g1, (unsigned)b1, 
-                    (unsigned)r2, (unsigned)g2, (unsigned)b2);
-            } else {
-                String_format_append(dest, 
-                    "\x1b[38;2;%u;%u;%um\x1b[48;2;%u;%u;%um\xe2\x96\x80",
-                    (unsigned)r1, (unsigned)g1, (unsigned)b1, 
-                    (unsigned)r2, (unsigned)g2, (unsigned)b2);
-            }
-            last_rgb1 = rgb1;
-            last_rgb2 = rgb2;
-        }
-        String_append_count(dest, "\x1b[0m\n", 5);
+// Downsample `mat` and store its cells in `grid`
+void sample_frame(const Renderer& r, const cv::Mat& mat, CellGrid& grid) {
+    cv::Mat bgr;
+    const cv::Mat* src = &mat;
+    uint32_t format = RENDER_BGR;
+    if (mat.type() == CV_8UC4) {
+        // Cameras leave the fourth byte undefined
+        format = RENDER_BGRX;
+    } else if (mat.type() == CV_8UC2) {
+        // Raw camera frames, sampled without converting every pixel
+        format = RENDER_YUY2;
+    } else if (mat.type() != CV_8UC3) {
+        cv::cvtColor(mat, bgr, mat.channels() == 1 ? cv::COLOR_GRAY2BGR
+                                                   : cv::COLOR_BGRA2BGR);
+        src = &bgr;
+    }
+    RenderImage img = RenderImage_from(src->data, src->cols, src->rows,
+                                       (uint32_t)src->step, format);
+    if (!Renderer_sample(&r, &img, &grid)) {
+        throw new std::bad_alloc();
     }
-    String_extend(dest, "\x1b[0m");
 }
 
 void get_console_size(int* w, int* h) {
@@ -498,35 +473,542 @@ void get_console_size(int* w, int* h) {
 #endif
 }
 
+// Default size of the generated test scenes
+#define SYNTHETIC_W 1280
+#define SYNTHETIC_H 720
 
-int main() {
+// Stages of the pipeline, for the latency log. A frame waits for the
+// encoder, is resized, sampled and encoded, waits for the writer and is
+// written.
+#define STAGE_QUEUE 0
+#define STAGE_RESIZE 1
+#define STAGE_SAMPLE 2
+#define STAGE_ENCODE 3
+#define STAGE_HANDOFF 4
+#define STAGE_WRITE 5
+#define STAGES 6
 
-    int cw, ch;
-    get_console_size(&cw, &ch);
+static const char* const stage_names[STAGES] = {
+    "queue", "resize", "sample", "encode", "handoff", "write"
+};
 
-    CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+// Set by signal handlers: stop capturing, or print the latency log
+static volatile std::sig_atomic_t quit_requested = 0;
+static volatile std::sig_atomic_t report_requested = 0;
+
+extern "C" void on_quit(int sig) {
+    (void)sig;
+    quit_requested = 1;
+}
+
+extern "C" void on_report(int sig) {
+    report_requested = 1;
+    std::signal(sig, on_report);
+}
+
+// Generated test scenes
+#define SYNTHETIC_GRADIENT 0
+#define SYNTHETIC_NOISE 1
+#define SYNTHETIC_STATIC 2
+// The static picture with camera noise that flickers each frame
+#define SYNTHETIC_GRAIN 3
+
+// Size of the patches of SYNTHETIC_GRAIN that flicker together. Noise in
+// single pixels would average out when downsampling.
+#define GRAIN_TILE 16
+
+// Hands the newest of a stream of values from one producer thread to one
+// consumer thread without locking. Of three slots the producer fills one,
+// the consumer reads one and the third holds the last published value,
+// which a newer value replaces if it was not taken yet.
+template <class T>
+class LatestSlot {
+    static constexpr uint32_t FRESH = 4;
+    T slots[3];
+    // Index of the published slot, with FRESH set until it is taken
+    std::atomic<uint32_t> shared{2};
+    uint32_t back = 0;
+    uint32_t front = 1;
+public:
+    // The slot the producer fills next
+    T& next() noexcept {
+        return slots[back];
+    }
+    // Publish the filled slot. Returns true if it replaced a value that was
+    // never taken.
+    bool publish() noexcept {
+        uint32_t old = shared.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = old & ~FRESH;
+        return (old & FRESH) != 0;
+    }
+    // Whether a value was published that was not taken yet
+    bool fresh() const noexcept {
+        return (shared.load(std::memory_order_acquire) & FRESH) != 0;
+    }
+    // Take the newest value, or nullptr if there is nothing new.
+    // It stays valid until the next call.
+    T* take() noexcept {
+        if (!fresh()) {
+            return nullptr;
+        }
+        uint32_t old = shared.exchange(front, std::memory_order_acq_rel);
+        front = old & ~FRESH;
+        return &slots[front];
+    }
+};
 
-    auto devices = FindCaptureDevices();
+// Lets a thread sleep until a LatestSlot has something for it. The values
+// are handed over without the mutex, it only keeps wakeups from being lost.
+class Waker {
+    std::mutex lock;
+    std::condition_variable cond;
+public:
+    void wake() {
+        { std::lock_guard<std::mutex> l(lock); }
+        cond.notify_one();
+    }
+    template <class F>
+    void wait(F ready) {
+        std::unique_lock<std::mutex> l(lock);
+        cond.wait(l, ready);
+    }
+};
 
-    int ix = -1;
+// Where frames come from
+class FrameSource {
+public:
+    // Size of the frames
     int w = 0;
     int h = 0;
 
-    for (auto dev: devices) {
-        ++ix;
-        printf("Name: %s, w: %d, h: %d\n", dev.name->buffer, dev.w, dev.h);
-        if (dev.name != "OBS Virtual Camera") {
-            w = dev.w;
-            h = dev.h;
+    virtual ~FrameSource() {}
+    // Read the next frame into `m` and store when it was captured, in the
+    // time of Pacer_now, in `time`. Returns false at the end of the source.
+    virtual bool read(cv::Mat& m, uint64_t& time) = 0;
+};
+
+// A source that makes its own frames, and hands them out every `delay` ms
+// like a camera would, or as fast as they are read if `delay` is 0
+class PacedSource : public FrameSource {
+    Pacer pacer;
+    uint32_t delay;
+protected:
+    void pace() {
+        if (delay > 0) {
+            while (!Pacer_wait(&pacer)) {}
+            Pacer_show(&pacer, delay);
+        }
+    }
+public:
+    PacedSource(uint32_t delay) : delay(delay) {
+        if (!Pacer_create(&pacer)) {
+            throw new std::bad_alloc();
+        }
+    }
+    ~PacedSource() {
+        Pacer_free(&pacer);
+    }
+};
+
+// The first camera that is not a virtual one
+class CameraSource : public FrameSource {
+    cv::VideoCapture cam;
+public:
+    // Open the camera at its own frame size. If `raw` is set frames are
+    // asked for as the camera sends them, which is YUY2 for most cameras
+    // with backends that support it.
+    bool open(bool raw) {
+#ifdef _WIN32
+        auto devices = FindCaptureDevices();
+
+        int ix = -1;
+        for (auto dev: devices) {
+            ++ix;
+            printf("Name: %s, w: %d, h: %d\n", dev.name->buffer, dev.w, dev.h);
+            if (dev.name != "OBS Virtual Camera") {
+                w = dev.w;
+                h = dev.h;
+                break;
+            }
+        }
+        if (ix < 0 || ix >= devices.size()) {
+            return false;
+        }
+
+        cam.open(ix, cv::CAP_DSHOW);
+        if (cam.isOpened()) {
+            std::printf("Open\n");
+        }
+        cam.set(cv::CAP_PROP_FRAME_WIDTH, w);
+        cam.set(cv::CAP_PROP_FRAME_HEIGHT, h);
+#else
+        if (!cam.open(0)) {
+            return false;
+        }
+        std::printf("Open\n");
+        w = (int)cam.get(cv::CAP_PROP_FRAME_WIDTH);
+        h = (int)cam.get(cv::CAP_PROP_FRAME_HEIGHT);
+#endif
+
+        if (raw) {
+            cam.set(cv::CAP_PROP_CONVERT_RGB, 0);
+        }
+
+        cv::Mat m;
+        cam.read(m);
+        return true;
+    }
+
+    bool read(cv::Mat& m, uint64_t& time) override {
+        // The grab is the capture, retrieving it decodes the frame
+        if (!cam.grab()) {
+            return false;
+        }
+        time = Pacer_now();
+        return cam.retrieve(m);
+    }
+};
+
+// Frames of a video file, read at the rate it was made for
+class VideoSource : public PacedSource {
+    cv::VideoCapture video;
+public:
+    VideoSource(cv::VideoCapture&& video, uint32_t delay)
+        : PacedSource(delay), video(std::move(video)) {
+        w = (int)this->video.get(cv::CAP_PROP_FRAME_WIDTH);
+        h = (int)this->video.get(cv::CAP_PROP_FRAME_HEIGHT);
+    }
+
+    // Open `path`, or return nullptr. If `pace` is not set frames are
+    // read as fast as they are asked for.
+    static VideoSource* open(const char* path, bool pace) {
+        cv::VideoCapture video;
+        if (!video.open(path) || !video.isOpened()) {
+            return nullptr;
+        }
+        double fps = video.get(cv::CAP_PROP_FPS);
+        uint32_t delay = (pace && fps > 0) ? (uint32_t)(1000 / fps + 0.5) : 0;
+        VideoSource* src = new VideoSource(std::move(video), delay);
+        if (src->w <= 0 || src->h <= 0) {
+            delete src;
+            return nullptr;
+        }
+        return src;
+    }
+
+    bool read(cv::Mat& m, uint64_t& time) override {
+        pace();
+        bool ok = video.read(m);
+        time = Pacer_now();
+        return ok;
+    }
+};
+
+// Generated test scenes, the same on every run. See SYNTHETIC_ for the
+// kinds of scene.
+class SyntheticSource : public PacedSource {
+    uint32_t pattern;
+    uint64_t frame = 0;
+    // The still picture of SYNTHETIC_STATIC and SYNTHETIC_GRAIN
+    cv::Mat still;
+
+    // Color gradients that move a pixel per frame
+    void gradient(cv::Mat& m, uint64_t n) {
+        m.create(h, w, CV_8UC3);
+        for (int y = 0; y < h; ++y) {
+            uint8_t* row = m.ptr<uint8_t>(y);
+            for (int x = 0; x < w; ++x) {
+                row[3 * x] = (uint8_t)(x + n);
+                row[3 * x + 1] = (uint8_t)(y + n);
+                row[3 * x + 2] = (uint8_t)((x + y) / 2 - n);
+            }
+        }
+    }
+
+    // Every pixel random, seeded by the frame number
+    void noise(cv::Mat& m, uint64_t n) {
+        m.create(h, w, CV_8UC3);
+        uint32_t state = (uint32_t)(n * 0x9e3779b9u) | 1;
+        for (int y = 0; y < h; ++y) {
+            uint8_t* row = m.ptr<uint8_t>(y);
+            for (int x = 0; x < 3 * w; x += 4) {
+                // xorshift32
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                for (int i = 0; i < 4 && x + i < 3 * w; ++i) {
+                    row[x + i] = (uint8_t)(state >> (8 * i));
+                }
+            }
+        }
+    }
+
+    // The still picture, each tile made up to 3 levels darker or brighter
+    // at random
+    void grain(cv::Mat& m, uint64_t n) {
+        still.copyTo(m);
+        uint32_t state = (uint32_t)(n * 0x9e3779b9u) | 1;
+        for (int ty = 0; ty < h; ty += GRAIN_TILE) {
+            for (int tx = 0; tx < w; tx += GRAIN_TILE) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                int d = (int)(state % 7) - 3;
+                for (int y = ty; y < ty + GRAIN_TILE && y < h; ++y) {
+                    uint8_t* row = m.ptr<uint8_t>(y);
+                    int x1 = tx + GRAIN_TILE < w ? tx + GRAIN_TILE : w;
+                    for (int x = 3 * tx; x < 3 * x1; ++x) {
+                        int v = row[x] + d;
+                        row[x] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+                    }
+                }
+            }
+        }
+    }
+public:
+    SyntheticSource(uint32_t pattern, int sw, int sh, uint32_t delay)
+        : PacedSource(delay), pattern(pattern) {
+        w = sw;
+        h = sh;
+        if (pattern == SYNTHETIC_STATIC || pattern == SYNTHETIC_GRAIN) {
+            gradient(still, 0);
+        }
+    }
+
+    bool read(cv::Mat& m, uint64_t& time) override {
+        pace();
+        if (pattern == SYNTHETIC_NOISE) {
+            noise(m, frame);
+        } else if (pattern == SYNTHETIC_STATIC) {
+            still.copyTo(m);
+        } else if (pattern == SYNTHETIC_GRAIN) {
+            grain(m, frame);
+        } else {
+            gradient(m, frame);
+        }
+        time = Pacer_now();
+        ++frame;
+        return true;
+    }
+};
+
+struct CapturedFrame {
+    cv::Mat mat;
+    uint64_t time;
+};
+
+struct EncodedFrame {
+    // When the frame was captured and left each stage, see STAGE_
+    uint64_t stamps[STAGES + 1];
+    RefString str;
+#ifdef _WIN32
+    RefWString wide;
+#endif
+};
+
+// Frames are captured, encoded and written on three threads, so a slow
+// terminal does not hold up the camera. The encoder always takes the
+// newest capture and skips the ones it had no time for.
+struct Pipeline {
+    LatestSlot<CapturedFrame> captured;
+    LatestSlot<EncodedFrame> encoded;
+    Waker encoder;
+    Waker writer;
+    std::atomic<bool> captured_all{false};
+    std::atomic<bool> encoded_all{false};
+    // Quality level picked by the writer for the encoder
+    std::atomic<uint32_t> scale_step{0};
+    std::atomic<uint32_t> color_bits{8};
+    uint64_t captured_count = 0;
+    uint64_t written_count = 0;
+    uint64_t written_bytes = 0;
+    // Kept by the writer
+    Latency latency;
+};
+
+// Capture until the source ends, or `limit` frames if it is not 0
+void capture_frames(Pipeline& p, FrameSource& src, uint64_t limit) {
+    while ((limit == 0 || p.captured_count < limit) && !quit_requested) {
+        CapturedFrame& f = p.captured.next();
+        if (!src.read(f.mat, f.time)) {
+            break;
+        }
+        ++p.captured_count;
+        p.captured.publish();
+        p.encoder.wake();
+    }
+    p.captured_all = true;
+    p.encoder.wake();
+}
+
+void write_frame(const EncodedFrame& f) {
+#ifdef _WIN32
+    WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), f.wide->buffer,
+                  f.wide->length, NULL, NULL);
+#else
+    fwrite(f.str->buffer, 1, f.str->length, stdout);
+    fflush(stdout);
+#endif
+}
+
+// Write encoded frames until the encoder is done, adapting `quality` to
+// how long the writes take if `adapt` is set
+void write_frames(Pipeline& p, Quality& quality, bool adapt, int fps) {
+    while (true) {
+        p.writer.wait([&] { return p.encoded.fresh() || p.encoded_all; });
+        EncodedFrame* f = p.encoded.take();
+        if (f == nullptr) {
             break;
         }
+        // The encoder may be waiting for the slot
+        p.encoder.wake();
+        ++p.written_count;
+        uint64_t write_start = Pacer_now();
+        f->stamps[STAGE_HANDOFF + 1] = write_start;
+        if (f->str->length > 0) {
+            write_frame(*f);
+        }
+        f->stamps[STAGE_WRITE + 1] = Pacer_now();
+        Latency_add(&p.latency, f->stamps);
+        if (report_requested) {
+            report_requested = 0;
+            RefString report;
+            if (Latency_report(&p.latency, report)) {
+                fwrite(report->buffer, 1, report->length, stderr);
+            }
+        }
+        if (f->str->length == 0) {
+            continue;
+        }
+        p.written_bytes += f->str->length;
+        if (adapt) {
+            Quality_update(&quality, f->str->length,
+                           f->stamps[STAGE_WRITE + 1] - write_start,
+                           1000000000ull / fps);
+            p.scale_step = Quality_scale(&quality);
+            p.color_bits = Quality_color_bits(&quality);
+        }
     }
-    if (ix < 0 || ix >= devices.size()) {
-        printf("Device not found\n");
-        CoUninitialize();
-        return 1;
+}
+
+int main(int argc, char** argv) {
+    bool delta = false;
+    bool adapt = true;
+    int fps = 30;
+    int jobs = 0;
+    int synthetic = -1;
+    const char* video = nullptr;
+    int sw = SYNTHETIC_W;
+    int sh = SYNTHETIC_H;
+    bool pace = true;
+    bool raw = false;
+    // Changes of up to `hysteresis` in a channel are held back for up to
+    // `hold_frames` frames
+    uint32_t hysteresis = 0;
+    uint32_t hold_frames = 10;
+    uint64_t limit = 0;
+    EncodeOptions opts = {};
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--delta") == 0) {
+            delta = true;
+        } else if (strcmp(argv[i], "-f") == 0 ||
+                   strcmp(argv[i], "--fixed-quality") == 0) {
+            adapt = false;
+        } else if (strcmp(argv[i], "--repeat") == 0) {
+            opts.repeat = true;
+        } else if ((strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--fps") == 0) &&
+                   i + 1 < argc) {
+            fps = atoi(argv[++i]);
+            if (fps <= 0) {
+                fps = 30;
+            }
+        } else if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--tolerance") == 0) &&
+                   i + 1 < argc) {
+            int tolerance = atoi(argv[++i]);
+            opts.tolerance = tolerance > 0 ? tolerance : 0;
+        } else if ((strcmp(argv[i], "-H") == 0 || strcmp(argv[i], "--hysteresis") == 0) &&
+                   i + 1 < argc) {
+            int threshold = atoi(argv[++i]);
+            hysteresis = threshold > 0 ? threshold : 0;
+        } else if (strcmp(argv[i], "--hold-frames") == 0 && i + 1 < argc) {
+            int frames = atoi(argv[++i]);
+            hold_frames = frames > 0 ? frames : 1;
+        } else if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) &&
+                   i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--synthetic") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "gradient") == 0) {
+                synthetic = SYNTHETIC_GRADIENT;
+            } else if (strcmp(argv[i], "noise") == 0) {
+                synthetic = SYNTHETIC_NOISE;
+            } else if (strcmp(argv[i], "static") == 0) {
+                synthetic = SYNTHETIC_STATIC;
+            } else if (strcmp(argv[i], "grain") == 0) {
+                synthetic = SYNTHETIC_GRAIN;
+            } else {
+                printf("Unknown scene %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--video") == 0 && i + 1 < argc) {
+            video = argv[++i];
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &sw, &sh) != 2 || sw <= 0 || sh <= 0) {
+                sw = SYNTHETIC_W;
+                sh = SYNTHETIC_H;
+            }
+        } else if (strcmp(argv[i], "--raw") == 0) {
+            raw = true;
+        } else if (strcmp(argv[i], "--no-pace") == 0) {
+            pace = false;
+        } else if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--frames") == 0) &&
+                   i + 1 < argc) {
+            int frames = atoi(argv[++i]);
+            limit = frames > 0 ? frames : 0;
+        } else if ((strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--colors") == 0) &&
+                   i + 1 < argc) {
+            int colors = atoi(argv[++i]);
+            if (colors == 256 || colors == 16) {
+                palette_init();
+                opts.colors = colors == 256 ? ENCODE_256 : ENCODE_16;
+            }
+        }
     }
 
+    int cw, ch;
+    get_console_size(&cw, &ch);
+    downsample_init();
+
+#ifdef _WIN32
+    CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+#endif
+
+    std::unique_ptr<FrameSource> source;
+    if (synthetic >= 0) {
+        source.reset(new SyntheticSource(synthetic, sw, sh, pace ? 1000 / fps : 0));
+    } else if (video != nullptr) {
+        source.reset(VideoSource::open(video, pace));
+        if (!source) {
+            printf("Could not open %s\n", video);
+#ifdef _WIN32
+            CoUninitialize();
+#endif
+            return 1;
+        }
+    } else {
+        CameraSource* cam = new CameraSource();
+        source.reset(cam);
+        if (!cam->open(raw)) {
+            printf("Device not found\n");
+#ifdef _WIN32
+            CoUninitialize();
+#endif
+            return 1;
+        }
+    }
+    int w = source->w;
+    int h = source->h;
+
     ch = ch * 2; // Two pixels per row
 
     int scale = 1;
@@ -539,41 +1021,140 @@ int main() {
         ph = (h + scale - 1) / scale;
     }
 
-    auto cam = cv::VideoCapture();
-
-    cam.open(ix, cv::CAP_DSHOW);
-
-    if (cam.isOpened()) {
-        std::printf("Open\n");
+    WorkPool* pool = nullptr;
+    if (jobs != 1) {
+        pool = WorkPool_create(jobs < 0 ? 0 : jobs);
     }
+    Renderer renderer;
+    CellGrid grids[2];
+    if (!Renderer_create(&renderer, pw, ph, pool) ||
+        !CellGrid_create(&grids[0], pw, (ph + 1) / 2) ||
+        !CellGrid_create(&grids[1], pw, (ph + 1) / 2)) {
+        throw new std::bad_alloc();
+    }
+    renderer.opts = opts;
+    Hysteresis hyst;
+    if (!Hysteresis_create(&hyst, pw, (ph + 1) / 2, hysteresis, hold_frames)) {
+        throw new std::bad_alloc();
+    }
+    uint64_t frame = 0;
+    Quality quality;
+    Quality_create(&quality);
 
-    RefString s;
-    RefWString out;
-
-    cam.set(cv::CAP_PROP_FRAME_WIDTH, w);
-    cam.set(cv::CAP_PROP_FRAME_HEIGHT, h);
-
-    cv::Mat m, converted;
-    cam.read(m);
+    Pipeline pipe;
+    pipe.scale_step = Quality_scale(&quality);
+    pipe.color_bits = Quality_color_bits(&quality);
+    if (!Latency_create(&pipe.latency, STAGES, stage_names)) {
+        throw new std::bad_alloc();
+    }
 
+    // Ctrl-C ends the capture, so the frames in flight and the stats are
+    // still written. Ctrl-Break, or SIGUSR1, prints the latency so far.
+    std::signal(SIGINT, on_quit);
+#ifdef _WIN32
+    std::signal(SIGBREAK, on_report);
+#else
+    std::signal(SIGUSR1, on_report);
+#endif
 
     printf("Dims: %d, %d\n", pw, ph);
-    while (cam.read(m)) {
-        cv::resize(m, converted, cv::Size(pw, ph), cv::INTER_LINEAR);
+    uint64_t start = Pacer_now();
+    std::thread capture_thread(capture_frames, std::ref(pipe), std::ref(*source), limit);
+    std::thread write_thread(write_frames, std::ref(pipe), std::ref(quality), adapt, fps);
 
-        String_clear(s);
-        String_format_append(s, "\x1b[1;1H");
-        convert_frame(s, converted);
+    cv::Mat bgr;
+    cv::Mat resized;
+    while (true) {
+        pipe.encoder.wait([&] { return pipe.captured.fresh() || pipe.captured_all; });
+        CapturedFrame* in = pipe.captured.take();
+        if (in == nullptr) {
+            break;
+        }
+        EncodedFrame& out = pipe.encoded.next();
+        out.stamps[0] = in->time;
+        out.stamps[STAGE_QUEUE + 1] = Pacer_now();
+        const cv::Mat* m = &in->mat;
+        if (m->cols != w || m->rows != h) {
+            // The buffers are sized for the size asked for. Resizing YUY2
+            // would mix U and V of neighbouring pixels.
+            if (m->type() == CV_8UC2) {
+                cv::cvtColor(*m, bgr, cv::COLOR_YUV2BGR_YUY2);
+                m = &bgr;
+            }
+            cv::resize(*m, resized, cv::Size(w, h), 0, 0, cv::INTER_AREA);
+            m = &resized;
+        }
+        out.stamps[STAGE_RESIZE + 1] = Pacer_now();
+        // The grids are sized for the base scale, lower quality levels
+        // use part of them
+        renderer.scale = scale + pipe.scale_step;
+        renderer.color_bits = pipe.color_bits;
 
-        WString_from_utf8_bytes(out, s->buffer, s->length);
-        WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), out->buffer,
-                      out->length, NULL, NULL);
+        String* s = out.str;
+        String_clear(s);
+        CellGrid& grid = grids[frame % 2];
+        const CellGrid& last = grids[(frame + 1) % 2];
+        sample_frame(renderer, *m, grid);
+        if (hysteresis > 0 && frame > 0) {
+            Hysteresis_apply(&hyst, &grid, &last);
+        }
+        out.stamps[STAGE_SAMPLE + 1] = Pacer_now();
+        const CellGrid* prev = (delta && frame > 0) ? &last : nullptr;
+        if (frame > 0 && (last.cols != grid.cols || last.rows != grid.rows)) {
+            // Clear what the frame at the previous scale leaves around
+            // this one
+            prev = nullptr;
+            if (!String_extend(s, "\x1b[2J")) {
+                throw new std::bad_alloc();
+            }
+        }
+        if (!Renderer_encode(&renderer, s, &grid, prev)) {
+            throw new std::bad_alloc();
+        }
+#ifdef _WIN32
+        WString_from_utf8_bytes(out.wide, s->buffer, s->length);
+#endif
+        out.stamps[STAGE_ENCODE + 1] = Pacer_now();
+        ++frame;
 
-        Sleep(10);
+        // Delta frames build on the frame before them, so none may be
+        // skipped. Wait for the writer to take the last one.
+        pipe.encoder.wait([&] { return !pipe.encoded.fresh(); });
+        pipe.encoded.publish();
+        pipe.writer.wake();
     }
+    pipe.encoded_all = true;
+    pipe.writer.wake();
+    capture_thread.join();
+    write_thread.join();
+    double seconds = (Pacer_now() - start) / 1e9;
+
     printf("Exit\n");
+    printf("Frames: %llu captured, %llu dropped, %llu written, %.1f fps, "
+           "%.0f bytes per frame\n",
+           (unsigned long long)pipe.captured_count,
+           (unsigned long long)(pipe.captured_count - frame),
+           (unsigned long long)pipe.written_count,
+           seconds > 0 ? pipe.written_count / seconds : 0.0,
+           pipe.written_count > 0
+               ? (double)pipe.written_bytes / pipe.written_count : 0.0);
+    RefString report;
+    if (!Latency_report(&pipe.latency, report)) {
+        throw new std::bad_alloc();
+    }
+    fwrite(report->buffer, 1, report->length, stdout);
+
+    CellGrid_free(&grids[0]);
+    CellGrid_free(&grids[1]);
+    Renderer_free(&renderer);
+    Latency_free(&pipe.latency);
+    Hysteresis_free(&hyst);
+    WorkPool_free(pool);
+    source.reset();
 
+#ifdef _WIN32
     CoUninitialize();
+#endif
 
     return 0;
 }
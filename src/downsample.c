@@ -0,0 +1,315 @@
+#include <string.h>
+
+#include "downsample.h"
+#include "mem.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DOWNSAMPLE_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define DOWNSAMPLE_NEON
+#include <arm_neon.h>
+#endif
+
+accumulate_row_fn accumulate_row = accumulate_row_scalar;
+blend_row_fn blend_row = blend_row_scalar;
+
+void accumulate_row_scalar(uint32_t* sums, const uint8_t* row, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+        sums[i] += row[i];
+    }
+}
+
+static inline uint8_t add_alpha(int32_t c, int32_t a, int32_t bg) {
+    return c + ((0xff - a) * (bg - c)) / 255;
+}
+
+void blend_row_scalar(uint8_t* rgba, uint32_t count, const uint8_t bg[3]) {
+    for (uint32_t i = 0; i < count; ++i, rgba += 4) {
+        uint8_t a = rgba[3];
+        rgba[0] = add_alpha(rgba[0], a, bg[0]);
+        rgba[1] = add_alpha(rgba[1], a, bg[1]);
+        rgba[2] = add_alpha(rgba[2], a, bg[2]);
+        rgba[3] = 0xff;
+    }
+}
+
+// The vector blends compute (0xff - a) * |bg - c| in 16 bit lanes and
+// divide by 255 using (x + 1 + (x >> 8)) >> 8, which is exact for
+// 0 <= x <= 0xfe01. The sign is applied afterwards to truncate towards
+// zero like the scalar division.
+
+#ifdef DOWNSAMPLE_X86
+
+static void accumulate_row_sse2(uint32_t* sums, const uint8_t* row, uint32_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i*)(row + i));
+        __m128i lo = _mm_unpacklo_epi8(b, zero);
+        __m128i hi = _mm_unpackhi_epi8(b, zero);
+        __m128i* s = (__m128i*)(sums + i);
+        _mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s),
+                                          _mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1),
+                                              _mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_si128(s + 2, _mm_add_epi32(_mm_loadu_si128(s + 2),
+                                              _mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_si128(s + 3, _mm_add_epi32(_mm_loadu_si128(s + 3),
+                                              _mm_unpackhi_epi16(hi, zero)));
+    }
+    accumulate_row_scalar(sums + i, row + i, count - i);
+}
+
+// Blend two pixels widened to 16 bit lanes
+static inline __m128i blend_px2_sse2(__m128i px, __m128i bg) {
+    const __m128i ff = _mm_set1_epi16(0xff);
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i a = _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3));
+    a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i d = _mm_sub_epi16(bg, px);
+    __m128i sign = _mm_srai_epi16(d, 15);
+    d = _mm_sub_epi16(_mm_xor_si128(d, sign), sign);
+    __m128i x = _mm_mullo_epi16(d, _mm_sub_epi16(ff, a));
+    x = _mm_add_epi16(_mm_add_epi16(x, one), _mm_srli_epi16(x, 8));
+    x = _mm_srli_epi16(x, 8);
+    x = _mm_sub_epi16(_mm_xor_si128(x, sign), sign);
+    return _mm_add_epi16(px, x);
+}
+
+static void blend_row_sse2(uint8_t* rgba, uint32_t count, const uint8_t bg[3]) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    const __m128i bgv = _mm_setr_epi16(bg[0], bg[1], bg[2], 0,
+                                       bg[0], bg[1], bg[2], 0);
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i* p = (__m128i*)(rgba + 4 * i);
+        __m128i b = _mm_loadu_si128(p);
+        __m128i lo = blend_px2_sse2(_mm_unpacklo_epi8(b, zero), bgv);
+        __m128i hi = blend_px2_sse2(_mm_unpackhi_epi8(b, zero), bgv);
+        _mm_storeu_si128(p, _mm_or_si128(_mm_packus_epi16(lo, hi), alpha));
+    }
+    blend_row_scalar(rgba + 4 * i, count - i, bg);
+}
+
+TARGET_AVX2
+static void accumulate_row_avx2(uint32_t* sums, const uint8_t* row, uint32_t count) {
+    uint32_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m128i b0 = _mm_loadu_si128((const __m128i*)(row + i));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(row + i + 16));
+        __m256i* s = (__m256i*)(sums + i);
+        _mm256_storeu_si256(s, _mm256_add_epi32(_mm256_loadu_si256(s),
+                                                _mm256_cvtepu8_epi32(b0)));
+        _mm256_storeu_si256(s + 1, _mm256_add_epi32(_mm256_loadu_si256(s + 1),
+                            _mm256_cvtepu8_epi32(_mm_srli_si128(b0, 8))));
+        _mm256_storeu_si256(s + 2, _mm256_add_epi32(_mm256_loadu_si256(s + 2),
+                                                    _mm256_cvtepu8_epi32(b1)));
+        _mm256_storeu_si256(s + 3, _mm256_add_epi32(_mm256_loadu_si256(s + 3),
+                            _mm256_cvtepu8_epi32(_mm_srli_si128(b1, 8))));
+    }
+    accumulate_row_sse2(sums + i, row + i, count - i);
+}
+
+TARGET_AVX2
+static void blend_row_avx2(uint8_t* rgba, uint32_t count, const uint8_t bg[3]) {
+    const __m256i ff = _mm256_set1_epi16(0xff);
+    const __m256i one = _mm256_set1_epi16(1);
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+    const __m256i bgv = _mm256_setr_epi16(bg[0], bg[1], bg[2], 0,
+                                          bg[0], bg[1], bg[2], 0,
+                                          bg[0], bg[1], bg[2], 0,
+                                          bg[0], bg[1], bg[2], 0);
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i* p = (__m128i*)(rgba + 4 * i);
+        __m256i px = _mm256_cvtepu8_epi16(_mm_loadu_si128(p));
+        __m256i a = _mm256_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3));
+        a = _mm256_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+        __m256i d = _mm256_sub_epi16(bgv, px);
+        __m256i sign = _mm256_srai_epi16(d, 15);
+        d = _mm256_sub_epi16(_mm256_xor_si256(d, sign), sign);
+        __m256i x = _mm256_mullo_epi16(d, _mm256_sub_epi16(ff, a));
+        x = _mm256_add_epi16(_mm256_add_epi16(x, one), _mm256_srli_epi16(x, 8));
+        x = _mm256_srli_epi16(x, 8);
+        x = _mm256_sub_epi16(_mm256_xor_si256(x, sign), sign);
+        x = _mm256_add_epi16(px, x);
+        __m128i res = _mm_packus_epi16(_mm256_castsi256_si128(x),
+                                       _mm256_extracti128_si256(x, 1));
+        _mm_storeu_si128(p, _mm_or_si128(res, _mm256_castsi256_si128(alpha)));
+    }
+    blend_row_scalar(rgba + 4 * i, count - i, bg);
+}
+
+static bool cpu_has_avx2(void) {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    // OSXSAVE and AVX
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) {
+        return false;
+    }
+    if ((_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+#ifdef DOWNSAMPLE_NEON
+
+static void accumulate_row_neon(uint32_t* sums, const uint8_t* row, uint32_t count) {
+    uint32_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t b = vld1q_u8(row + i);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(b));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(b));
+        uint32_t* s = sums + i;
+        vst1q_u32(s, vaddw_u16(vld1q_u32(s), vget_low_u16(lo)));
+        vst1q_u32(s + 4, vaddw_u16(vld1q_u32(s + 4), vget_high_u16(lo)));
+        vst1q_u32(s + 8, vaddw_u16(vld1q_u32(s + 8), vget_low_u16(hi)));
+        vst1q_u32(s + 12, vaddw_u16(vld1q_u32(s + 12), vget_high_u16(hi)));
+    }
+    accumulate_row_scalar(sums + i, row + i, count - i);
+}
+
+static inline uint8x8_t blend_channel_neon(uint8x8_t c, uint8x8_t inv_a,
+                                           uint8x8_t bg) {
+    // |bg - c| and the sign of bg - c
+    uint8x8_t d = vabd_u8(bg, c);
+    uint8x8_t neg = vclt_u8(bg, c);
+    uint16x8_t x = vmull_u8(d, inv_a);
+    x = vshrq_n_u16(vaddq_u16(vaddq_u16(x, vdupq_n_u16(1)),
+                              vshrq_n_u16(x, 8)), 8);
+    uint8x8_t q = vmovn_u16(x);
+    return vbsl_u8(neg, vsub_u8(c, q), vadd_u8(c, q));
+}
+
+static void blend_row_neon(uint8_t* rgba, uint32_t count, const uint8_t bg[3]) {
+    const uint8x8_t bgr = vdup_n_u8(bg[0]);
+    const uint8x8_t bgg = vdup_n_u8(bg[1]);
+    const uint8x8_t bgb = vdup_n_u8(bg[2]);
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x4_t px = vld4_u8(rgba + 4 * i);
+        uint8x8_t inv_a = vmvn_u8(px.val[3]);
+        px.val[0] = blend_channel_neon(px.val[0], inv_a, bgr);
+        px.val[1] = blend_channel_neon(px.val[1], inv_a, bgg);
+        px.val[2] = blend_channel_neon(px.val[2], inv_a, bgb);
+        px.val[3] = vdup_n_u8(0xff);
+        vst4_u8(rgba + 4 * i, px);
+    }
+    blend_row_scalar(rgba + 4 * i, count - i, bg);
+}
+
+#endif
+
+static bool wants(const char* name, const char* isa) {
+    return name == NULL || strcmp(name, isa) == 0;
+}
+
+const char* downsample_select(const char* name) {
+#if defined(DOWNSAMPLE_X86)
+    if (wants(name, "avx2") && cpu_has_avx2()) {
+        accumulate_row = accumulate_row_avx2;
+        blend_row = blend_row_avx2;
+        return "avx2";
+    }
+    // SSE2 is part of x86-64 and required by every cpu SDL3 supports
+    if (wants(name, "sse2")) {
+        accumulate_row = accumulate_row_sse2;
+        blend_row = blend_row_sse2;
+        return "sse2";
+    }
+#elif defined(DOWNSAMPLE_NEON)
+    if (wants(name, "neon")) {
+        accumulate_row = accumulate_row_neon;
+        blend_row = blend_row_neon;
+        return "neon";
+    }
+#endif
+    if (wants(name, "scalar")) {
+        accumulate_row = accumulate_row_scalar;
+        blend_row = blend_row_scalar;
+        return "scalar";
+    }
+    return NULL;
+}
+
+const char* downsample_init(void) {
+    return downsample_select(NULL);
+}
+
+bool downsample_rgba(const uint8_t* pixels, uint32_t pitch, uint32_t w,
+                     uint32_t h, uint32_t scale, uint8_t* dest) {
+    return downsample_rgba_rows(pixels, pitch, w, h, scale, dest,
+                                0, (h + scale - 1) / scale);
+}
+
+bool downsample_rgba_rows(const uint8_t* pixels, uint32_t pitch, uint32_t w,
+                          uint32_t h, uint32_t scale, uint8_t* dest,
+                          uint32_t y0, uint32_t y1) {
+    static const uint8_t rgba[4] = {0, 1, 2, 3};
+    return downsample_rows(pixels, pitch, w, h, 4, rgba, scale, dest, y0, y1);
+}
+
+bool downsample_rows(const uint8_t* pixels, uint32_t pitch, uint32_t w,
+                     uint32_t h, uint32_t bpp, const uint8_t order[4],
+                     uint32_t scale, uint8_t* dest, uint32_t y0, uint32_t y1) {
+    uint32_t pw = (w + scale - 1) / scale;
+    uint32_t* sums = Mem_alloc(w * bpp * sizeof(uint32_t));
+    if (sums == NULL) {
+        return false;
+    }
+    uint32_t ri = order[0], gi = order[1], bi = order[2], ai = order[3];
+
+    for (uint32_t oy = y0; oy < y1; ++oy) {
+        uint32_t sy0 = oy * scale;
+        uint32_t sy1 = sy0 + scale < h ? sy0 + scale : h;
+        memset(sums, 0, w * bpp * sizeof(uint32_t));
+        for (uint32_t y = sy0; y < sy1; ++y) {
+            accumulate_row(sums, pixels + y * pitch, w * bpp);
+        }
+        uint8_t* out = dest + oy * pw * 4;
+        for (uint32_t ox = 0; ox < pw; ++ox, out += 4) {
+            uint32_t x0 = ox * scale;
+            uint32_t x1 = x0 + scale < w ? x0 + scale : w;
+            uint32_t r = 0, g = 0, b = 0, a = 0;
+            for (uint32_t x = x0; x < x1; ++x) {
+                const uint32_t* px = sums + bpp * x;
+                r += px[ri];
+                g += px[gi];
+                b += px[bi];
+                if (ai != DOWNSAMPLE_NO_ALPHA) {
+                    a += px[ai];
+                }
+            }
+            uint32_t count = (x1 - x0) * (sy1 - sy0);
+            out[0] = r / count;
+            out[1] = g / count;
+            out[2] = b / count;
+            out[3] = ai != DOWNSAMPLE_NO_ALPHA ? a / count : 0xff;
+        }
+    }
+
+    Mem_free(sums);
+    return true;
+}
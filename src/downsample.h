@@ -0,0 +1,60 @@
+#ifndef DOWNSAMPLE_H_00
+#define DOWNSAMPLE_H_00
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Add each of the `count` bytes in `row` to the matching entry in `sums`
+typedef void (*accumulate_row_fn)(uint32_t* sums, const uint8_t* row,
+                                  uint32_t count);
+
+// Blend `count` RGBA pixels in `rgba` onto the color `bg`, in place.
+// The alpha of every pixel is set to 0xff.
+typedef void (*blend_row_fn)(uint8_t* rgba, uint32_t count, const uint8_t bg[3]);
+
+// Kernels selected by downsample_init
+extern accumulate_row_fn accumulate_row;
+extern blend_row_fn blend_row;
+
+// Reference implementations. The vectorized kernels must match these exactly.
+void accumulate_row_scalar(uint32_t* sums, const uint8_t* row, uint32_t count);
+void blend_row_scalar(uint8_t* rgba, uint32_t count, const uint8_t bg[3]);
+
+// Select kernels for the current cpu. Call once at startup.
+// Returns the name of the selected instruction set.
+const char* downsample_init(void);
+
+// Select the kernels for the instruction set `name`, "scalar", "sse2",
+// "avx2" or "neon". Returns NULL if the cpu or build does not support it.
+const char* downsample_select(const char* name);
+
+// Average each `scale` x `scale` block of the `w` x `h` RGBA image `pixels`
+// into `dest`, which must hold ((w + scale - 1) / scale) *
+// ((h + scale - 1) / scale) pixels.
+bool downsample_rgba(const uint8_t* pixels, uint32_t pitch, uint32_t w,
+                     uint32_t h, uint32_t scale, uint8_t* dest);
+
+// Same as downsample_rgba, but only computes the output rows [y0, y1)
+bool downsample_rgba_rows(const uint8_t* pixels, uint32_t pitch, uint32_t w,
+                          uint32_t h, uint32_t scale, uint8_t* dest,
+                          uint32_t y0, uint32_t y1);
+
+// Offset of the alpha channel in images without one
+#define DOWNSAMPLE_NO_ALPHA 0xff
+
+// Same as downsample_rgba_rows for images with `bpp` bytes per pixel, 3 or
+// 4. `order` holds the byte offsets of the red, green, blue and alpha
+// channels in a pixel, alpha is DOWNSAMPLE_NO_ALPHA for opaque images.
+// `dest` is RGBA, opaque images get an alpha of 0xff.
+bool downsample_rows(const uint8_t* pixels, uint32_t pitch, uint32_t w,
+                     uint32_t h, uint32_t bpp, const uint8_t order[4],
+                     uint32_t scale, uint8_t* dest, uint32_t y0, uint32_t y1);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
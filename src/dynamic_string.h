@@ -238,6 +238,7 @@ public:
 };
 
 
+#ifdef _WIN32
 class RefWString {
 private:
     WString str;
@@ -311,5 +312,6 @@ public:
     }
 };
 #endif
+#endif
 
 #endif
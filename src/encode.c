@@ -0,0 +1,909 @@
+#include <string.h>
+
+#include "encode.h"
+#include "ansi.h"
+#include "palette.h"
+#include "mem.h"
+
+// "\x1b[ROW;COLH" with 10 digit coordinates
+#define CUP_MAX 24
+
+// Color that never matches a cell, forcing the next SGR to be written
+#define NO_COLOR 0xffffffff
+
+bool CellGrid_create(CellGrid_noinit* grid, uint32_t cols, uint32_t rows) {
+    grid->cols = cols;
+    grid->rows = rows;
+    grid->cells = Mem_alloc((size_t)cols * rows * sizeof(Cell));
+    if (grid->cells == NULL) {
+        grid->cols = 0;
+        grid->rows = 0;
+        return false;
+    }
+    return true;
+}
+
+void CellGrid_free(CellGrid* grid) {
+    Mem_free(grid->cells);
+    grid->cells = NULL;
+    grid->cols = 0;
+    grid->rows = 0;
+}
+
+void CellGrid_from_rgba(CellGrid* grid, const uint8_t* rgba, uint32_t pixel_rows) {
+    CellGrid_from_rgba_rows(grid, rgba, pixel_rows, 0, grid->rows);
+}
+
+void CellGrid_from_rgba_rows(CellGrid* grid, const uint8_t* rgba,
+                             uint32_t pixel_rows, uint32_t y0, uint32_t y1) {
+    uint32_t cols = grid->cols;
+    for (uint32_t y = y0; y < y1; ++y) {
+        Cell* row = grid->cells + y * cols;
+        const uint8_t* top = rgba + 2 * y * cols * 4;
+        const uint8_t* bottom = top + cols * 4;
+        bool has_bottom = 2 * y + 1 < pixel_rows;
+        for (uint32_t x = 0; x < cols; ++x) {
+            row[x].top = CELL_RGB(top[4 * x], top[4 * x + 1], top[4 * x + 2]);
+            if (has_bottom) {
+                row[x].bottom = CELL_RGB(bottom[4 * x], bottom[4 * x + 1],
+                                         bottom[4 * x + 2]);
+            } else {
+                row[x].bottom = 0;
+            }
+        }
+    }
+}
+
+void CellGrid_quantize_rows(CellGrid* grid, uint32_t bits, uint32_t y0, uint32_t y1) {
+    if (bits >= 8) {
+        return;
+    }
+    uint32_t high = (0xff << (8 - bits)) & 0xff;
+    uint32_t mask = CELL_RGB(high, high, high);
+    uint32_t low = CELL_RGB(~high & 0xff, ~high & 0xff, ~high & 0xff);
+    Cell* cells = grid->cells + y0 * grid->cols;
+    uint32_t count = (y1 - y0) * grid->cols;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t top = cells[i].top & mask;
+        uint32_t bottom = cells[i].bottom & mask;
+        cells[i].top = top | ((top >> bits) & low);
+        cells[i].bottom = bottom | ((bottom >> bits) & low);
+    }
+}
+
+void CellGrid_mark_transparent_rows(CellGrid* grid, const uint8_t* alpha,
+                                    uint32_t pixel_rows, uint32_t y0, uint32_t y1) {
+    uint32_t cols = grid->cols;
+    for (uint32_t y = y0; y < y1; ++y) {
+        Cell* row = grid->cells + y * cols;
+        const uint8_t* top = alpha + 2 * y * cols;
+        const uint8_t* bottom = top + cols;
+        bool has_bottom = 2 * y + 1 < pixel_rows;
+        for (uint32_t x = 0; x < cols; ++x) {
+            if (top[x] == 0) {
+                row[x].top = CELL_TRANSPARENT;
+            }
+            if (has_bottom && bottom[x] == 0) {
+                row[x].bottom = CELL_TRANSPARENT;
+            }
+        }
+    }
+}
+
+static inline bool cell_equal(Cell a, Cell b) {
+    return a.top == b.top && a.bottom == b.bottom;
+}
+
+// Palette colors are written as keys, the palette index with one of these
+// flags set above the 24 bits of an RGB color
+#define KEY_256 0x01000000
+#define KEY_16 0x02000000
+
+// Key of the color written for `c` in color mode `colors`
+static inline uint32_t color_key(uint32_t c, uint32_t colors) {
+    if (colors == ENCODE_TRUECOLOR || c == CELL_TRANSPARENT) {
+        return c;
+    } else if (colors == ENCODE_256) {
+        return KEY_256 | palette_lut_256[palette_lut_index(CELL_R(c), CELL_G(c), CELL_B(c))];
+    }
+    return KEY_16 | palette_lut_16[palette_lut_index(CELL_R(c), CELL_G(c), CELL_B(c))];
+}
+
+static inline Cell cell_key(Cell c, uint32_t colors) {
+    Cell k = {color_key(c.top, colors), color_key(c.bottom, colors)};
+    return k;
+}
+
+// An RGB color that is exactly a 256 color palette entry is written as
+// "\x1b[38;5;Nm", which is always shorter than "\x1b[38;2;R;G;Bm".
+// Cube and gray entries are the same in practically every terminal.
+static inline char* write_fg(char* p, uint32_t key) {
+    if (key & KEY_256) {
+        return ansi_fg_256(p, (uint8_t)key);
+    } else if (key & KEY_16) {
+        return ansi_fg_16(p, (uint8_t)key);
+    }
+    int32_t n = palette_exact(CELL_R(key), CELL_G(key), CELL_B(key));
+    if (n >= 0) {
+        return ansi_fg_256(p, (uint8_t)n);
+    }
+    return ansi_fg_rgb(p, CELL_R(key), CELL_G(key), CELL_B(key));
+}
+
+// `dflt` is the color of the default background, written as "\x1b[49m"
+// like CELL_TRANSPARENT
+static inline char* write_bg(char* p, uint32_t key, uint32_t dflt) {
+    if (key == dflt || key == CELL_TRANSPARENT) {
+        memcpy(p, "\x1b[49m", 5);
+        return p + 5;
+    } else if (key & KEY_256) {
+        return ansi_bg_256(p, (uint8_t)key);
+    } else if (key & KEY_16) {
+        return ansi_bg_16(p, (uint8_t)key);
+    }
+    int32_t n = palette_exact(CELL_R(key), CELL_G(key), CELL_B(key));
+    if (n >= 0) {
+        return ansi_bg_256(p, (uint8_t)n);
+    }
+    return ansi_bg_rgb(p, CELL_R(key), CELL_G(key), CELL_B(key));
+}
+
+static inline uint32_t fg_len(uint32_t key) {
+    if (key & KEY_256) {
+        return ansi_256_len((uint8_t)key);
+    } else if (key & KEY_16) {
+        return ansi_fg_16_len((uint8_t)key);
+    }
+    int32_t n = palette_exact(CELL_R(key), CELL_G(key), CELL_B(key));
+    if (n >= 0) {
+        return ansi_256_len((uint8_t)n);
+    }
+    return ansi_rgb_len(CELL_R(key), CELL_G(key), CELL_B(key));
+}
+
+// Length of the background sequence for `key`, which is `fg` long as a
+// foreground one
+static inline uint32_t bg_len_of(uint32_t key, uint32_t fg, uint32_t dflt) {
+    if (key == dflt || key == CELL_TRANSPARENT) {
+        return 5;
+    } else if (key & KEY_16) {
+        return ansi_bg_16_len((uint8_t)key);
+    }
+    return fg;
+}
+
+static inline uint32_t bg_len(uint32_t key, uint32_t dflt) {
+    return bg_len_of(key, fg_len(key), dflt);
+}
+
+// Write the colors `set_fg` and `set_bg`, either of which may be NO_COLOR
+// to keep the current one. Both are joined into one sequence,
+// "\x1b[38;...;48;...m".
+static inline char* write_sgr(char* p, uint32_t set_fg, uint32_t set_bg,
+                              uint32_t dflt) {
+    if (set_fg != NO_COLOR) {
+        p = write_fg(p, set_fg);
+        if (set_bg != NO_COLOR) {
+            // Write the background over the last two bytes of "...Nm" and
+            // put them back as "N;", dropping the "\x1b["
+            char* join = p - 2;
+            char last = join[0];
+            p = write_bg(join, set_bg, dflt);
+            join[0] = last;
+            join[1] = ';';
+        }
+        return p;
+    }
+    if (set_bg != NO_COLOR) {
+        p = write_bg(p, set_bg, dflt);
+    }
+    return p;
+}
+
+// Whether `a` is within `tol` of `b`, using the "redmean" weighting of
+// squared channel differences. The sum is scaled so that a difference of
+// n in every channel is a distance of about n. Only used for RGB colors.
+static inline bool color_near(uint32_t a, uint32_t b, uint32_t tol) {
+    if (a == b) {
+        return true;
+    }
+    // Transparent and missing colors are only near themselves
+    if (tol == 0 || ((a | b) >> 24) != 0) {
+        return false;
+    }
+    int32_t rmean = (CELL_R(a) + CELL_R(b)) / 2;
+    int32_t dr = CELL_R(a) - CELL_R(b);
+    int32_t dg = CELL_G(a) - CELL_G(b);
+    int32_t db = CELL_B(a) - CELL_B(b);
+    uint32_t d = (((512 + rmean) * dr * dr) >> 8) + 4 * dg * dg +
+                 (((767 - rmean) * db * db) >> 8);
+    return d <= 9 * (uint64_t)tol * tol;
+}
+
+// Glyphs a cell can be drawn with
+// A space, both halves in the background color
+#define GLYPH_SPACE 0
+// "\u2588", both halves in the foreground color
+#define GLYPH_FULL 1
+// "\u2580", the top half in the foreground color
+#define GLYPH_UPPER 2
+// "\u2584", the top half in the background color
+#define GLYPH_LOWER 3
+
+static const char glyph_text[4][4] = {
+    " ", "\xe2\x96\x88", "\xe2\x96\x80", "\xe2\x96\x84"
+};
+static const uint8_t glyph_len[4] = {1, 3, 3, 3};
+
+// The colors to write to draw cell `c`, holding color keys, with `glyph`
+// when the current colors are `fg` and `bg`. NO_COLOR where the current
+// color is within `tol` of the one needed.
+static inline void glyph_colors(uint32_t glyph, Cell c, uint32_t fg, uint32_t bg,
+                                uint32_t tol, uint32_t* set_fg,
+                                uint32_t* set_bg) {
+    *set_fg = NO_COLOR;
+    *set_bg = NO_COLOR;
+    if (glyph == GLYPH_SPACE) {
+        if (!color_near(c.bottom, bg, tol) || !color_near(c.top, bg, tol)) {
+            *set_bg = c.bottom;
+        }
+    } else if (glyph == GLYPH_FULL) {
+        if (!color_near(c.bottom, fg, tol) || !color_near(c.top, fg, tol)) {
+            *set_fg = c.bottom;
+        }
+    } else if (glyph == GLYPH_UPPER) {
+        if (!color_near(c.top, fg, tol)) {
+            *set_fg = c.top;
+        }
+        if (!color_near(c.bottom, bg, tol)) {
+            *set_bg = c.bottom;
+        }
+    } else {
+        if (!color_near(c.bottom, fg, tol)) {
+            *set_fg = c.bottom;
+        }
+        if (!color_near(c.top, bg, tol)) {
+            *set_bg = c.top;
+        }
+    }
+}
+
+// Number of bytes write_sgr writes
+static inline uint32_t sgr_len(uint32_t set_fg, uint32_t set_bg, uint32_t dflt) {
+    if (set_fg == NO_COLOR) {
+        return set_bg == NO_COLOR ? 0 : bg_len(set_bg, dflt);
+    }
+    if (set_bg == NO_COLOR) {
+        return fg_len(set_fg);
+    }
+    return fg_len(set_fg) + bg_len(set_bg, dflt) - 2;
+}
+
+// The first of the two glyphs that can draw `c`. A cell in one color is a
+// space or a full block, otherwise it is a half block either way up.
+static inline uint32_t first_glyph(Cell c, uint32_t tol) {
+    return color_near(c.top, c.bottom, tol) ? GLYPH_SPACE : GLYPH_UPPER;
+}
+
+// Draw `c` with `glyph`, updating the current colors
+static inline char* draw_cell(char* p, uint32_t glyph, Cell c, uint32_t* fg,
+                              uint32_t* bg, uint32_t tol, uint32_t dflt) {
+    uint32_t set_fg, set_bg;
+    glyph_colors(glyph, c, *fg, *bg, tol, &set_fg, &set_bg);
+    p = write_sgr(p, set_fg, set_bg, dflt);
+    if (set_fg != NO_COLOR) {
+        *fg = set_fg;
+    }
+    if (set_bg != NO_COLOR) {
+        *bg = set_bg;
+    }
+    memcpy(p, glyph_text[glyph], 4);
+    return p + glyph_len[glyph];
+}
+
+// Pick the cheaper glyph for `c` given the current colors. Stores the
+// bytes it takes in `cost`.
+static inline uint32_t choose_glyph(Cell c, uint32_t fg, uint32_t bg,
+                                    uint32_t tol, uint32_t dflt,
+                                    uint32_t* cost) {
+    uint32_t glyph = first_glyph(c, tol);
+    uint32_t set_fg, set_bg;
+    glyph_colors(glyph, c, fg, bg, tol, &set_fg, &set_bg);
+    *cost = sgr_len(set_fg, set_bg, dflt) + glyph_len[glyph];
+    // Only the background can be transparent
+    if (c.top == CELL_TRANSPARENT || c.bottom == CELL_TRANSPARENT) {
+        if (c.top == c.bottom || c.bottom == CELL_TRANSPARENT) {
+            return glyph;
+        }
+        glyph_colors(GLYPH_LOWER, c, fg, bg, tol, &set_fg, &set_bg);
+        *cost = sgr_len(set_fg, set_bg, dflt) + 3;
+        return GLYPH_LOWER;
+    }
+    glyph_colors(glyph + 1, c, fg, bg, tol, &set_fg, &set_bg);
+    uint32_t other = sgr_len(set_fg, set_bg, dflt) + glyph_len[glyph + 1];
+    if (other < *cost) {
+        *cost = other;
+        return glyph + 1;
+    }
+    return glyph;
+}
+
+// Write cell `c`, holding color keys, with the fewest bytes given the
+// current colors
+static inline char* encode_cell(char* p, Cell c, uint32_t* fg, uint32_t* bg,
+                                uint32_t tol, uint32_t dflt) {
+    uint32_t cost;
+    uint32_t glyph = choose_glyph(c, *fg, *bg, tol, dflt, &cost);
+    return draw_cell(p, glyph, c, fg, bg, tol, dflt);
+}
+
+// Number of bytes encode_cell would write
+static inline uint32_t cell_cost(Cell c, uint32_t* fg, uint32_t* bg,
+                                 uint32_t tol, uint32_t dflt) {
+    uint32_t cost;
+    uint32_t glyph = choose_glyph(c, *fg, *bg, tol, dflt, &cost);
+    uint32_t set_fg, set_bg;
+    glyph_colors(glyph, c, *fg, *bg, tol, &set_fg, &set_bg);
+    if (set_fg != NO_COLOR) {
+        *fg = set_fg;
+    }
+    if (set_bg != NO_COLOR) {
+        *bg = set_bg;
+    }
+    return cost;
+}
+
+static bool reserve(String* dest, uint64_t bound) {
+    if (dest->length + bound > 0x7fffffff) {
+        return false;
+    }
+    return String_reserve(dest, dest->length + bound);
+}
+
+static inline void finish(String* dest, char* p) {
+    dest->length = p - dest->buffer;
+    dest->buffer[dest->length] = '\0';
+}
+
+// Number of cells from `x` on that are equal to `c`, holding color keys
+static inline uint32_t run_length(const Cell* row, uint32_t x, uint32_t cols,
+                                  Cell c, uint32_t colors) {
+    uint32_t n = 0;
+    while (x + n < cols && cell_equal(cell_key(row[x + n], colors), c)) {
+        ++n;
+    }
+    return n;
+}
+
+// Number of cells from `x` on that are transparent in both halves
+static inline uint32_t transparent_run(const Cell* row, uint32_t x,
+                                       uint32_t cols) {
+    uint32_t n = 0;
+    while (x + n < cols && row[x + n].top == CELL_TRANSPARENT &&
+           row[x + n].bottom == CELL_TRANSPARENT) {
+        ++n;
+    }
+    return n;
+}
+
+// Move past the `n` transparent cells starting at `x`, leaving them
+// unpainted. Nothing is written for cells that end the row.
+static inline char* skip_cells(char* p, uint32_t x, uint32_t n, uint32_t cols) {
+    return x + n < cols ? ansi_cuf(p, n) : p;
+}
+
+// Draw the glyph just written, `len` bytes long, `n` more times. Long
+// runs use REP, "\x1b[Nb". A run of spaces that ends the row in the
+// default background can erase to the end of the line instead when
+// `erase` is set, which leaves the cursor at the start of the run.
+static inline char* repeat_glyph(char* p, uint32_t len, uint32_t n,
+                                 bool erase) {
+    if (erase && n > 3) {
+        memcpy(p, "\x1b[K", 3);
+        return p + 3;
+    }
+    if (3 + ansi_uint_len(n) < n * len) {
+        return ansi_rep(p, n);
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        memcpy(p, p - len, len);
+        p += len;
+    }
+    return p;
+}
+
+// Color states kept per cell when searching a row
+#define ROW_STATES 2
+
+typedef struct RowState {
+    uint32_t fg;
+    uint32_t bg;
+    uint32_t cost;
+} RowState;
+
+// Length of the sequences setting the foreground with `fg` bytes and the
+// background with `bg` bytes, 0 for colors that are not set
+static inline uint32_t pair_len(uint32_t fg, uint32_t bg) {
+    return fg + bg - (fg != 0 && bg != 0 ? 2 : 0);
+}
+
+// Add state `s`, reached from state `i` with `glyph`, to the `count`
+// states in `next`, sorted by cost. Keeps the cheaper one of equal states.
+static inline void add_state(RowState* next, uint8_t* from, uint32_t* count,
+                             RowState s, uint32_t i, uint32_t glyph) {
+    uint32_t j = 0;
+    while (j < *count && (next[j].fg != s.fg || next[j].bg != s.bg)) {
+        ++j;
+    }
+    if (j < *count && next[j].cost <= s.cost) {
+        return;
+    }
+    if (j == *count) {
+        ++*count;
+    }
+    while (j > 0 && next[j - 1].cost > s.cost) {
+        next[j] = next[j - 1];
+        from[j] = from[j - 1];
+        --j;
+    }
+    next[j] = s;
+    from[j] = (uint8_t)(i << 2 | glyph);
+}
+
+// Whether `glyph` can draw `c`, which is in one color within the tolerance
+// when `one`. The foreground is never transparent.
+static inline bool glyph_fits(uint32_t glyph, Cell c, bool one) {
+    if (glyph == GLYPH_SPACE) {
+        return one;
+    } else if (glyph == GLYPH_FULL) {
+        return one && c.top != CELL_TRANSPARENT;
+    } else if (glyph == GLYPH_UPPER) {
+        return c.top != CELL_TRANSPARENT;
+    }
+    return c.bottom != CELL_TRANSPARENT;
+}
+
+// Advance the `count` states in `states` over cell `c` when colors within
+// `tol` of the current ones are kept. Which colors are kept depends on the
+// state, so every glyph is tried from every state. Returns the new count.
+static inline uint32_t near_step(RowState* states, uint8_t* from,
+                                 uint32_t count, Cell c, uint32_t tol,
+                                 uint32_t dflt) {
+    RowState next[4 * ROW_STATES];
+    uint8_t next_from[4 * ROW_STATES];
+    uint32_t next_count = 0;
+    bool one = color_near(c.top, c.bottom, tol);
+    for (uint32_t i = 0; i < count; ++i) {
+        for (uint32_t glyph = 0; glyph < 4; ++glyph) {
+            if (!glyph_fits(glyph, c, one)) {
+                continue;
+            }
+            uint32_t set_fg, set_bg;
+            glyph_colors(glyph, c, states[i].fg, states[i].bg, tol,
+                         &set_fg, &set_bg);
+            RowState s = {set_fg == NO_COLOR ? states[i].fg : set_fg,
+                          set_bg == NO_COLOR ? states[i].bg : set_bg,
+                          states[i].cost + sgr_len(set_fg, set_bg, dflt) +
+                          glyph_len[glyph]};
+            add_state(next, next_from, &next_count, s, i, glyph);
+        }
+    }
+    count = next_count < ROW_STATES ? next_count : ROW_STATES;
+    memcpy(states, next, count * sizeof(RowState));
+    memcpy(from, next_from, count);
+    return count;
+}
+
+// Write a row of cells in the fewest bytes. The glyph
+// picked for one cell decides which colors the next cells can reuse, so
+// every cell keeps the cheapest few color states reachable after it, and
+// `path` records how each was reached, ROW_STATES entries per cell. `fg`
+// and `bg` hold the colors before and after the row. Colors within `tol`
+// of the current ones are kept, which is only used with RGB colors. With `repeat`, runs
+// of equal cells use repeat_glyph. With `blank`, fully transparent cells
+// are skipped.
+static inline char* encode_row(char* p, const Cell* row, uint32_t cols,
+                               uint32_t* fg, uint32_t* bg, uint32_t colors,
+                               uint32_t tol, uint32_t dflt, bool repeat,
+                               bool blank, uint8_t* path) {
+    RowState states[ROW_STATES] = {{*fg, *bg, 0}};
+    uint32_t count = 1;
+    for (uint32_t x = 0; x < cols; ++x) {
+        Cell c = cell_key(row[x], colors);
+        uint8_t* from = path + x * ROW_STATES;
+        if (tol != 0 && (c.top != CELL_TRANSPARENT ||
+                         c.bottom != CELL_TRANSPARENT)) {
+            count = near_step(states, from, count, c, tol, dflt);
+            continue;
+        }
+        if (c.top != c.bottom) {
+            // Either way up leaves both colors set, so there are only two
+            // states to reach
+            uint32_t fg_top = fg_len(c.top), fg_bottom = fg_len(c.bottom);
+            uint32_t bg_top = bg_len_of(c.top, fg_top, dflt);
+            uint32_t bg_bottom = bg_len_of(c.bottom, fg_bottom, dflt);
+            RowState upper = {c.top, c.bottom, UINT32_MAX};
+            RowState lower = {c.bottom, c.top, UINT32_MAX};
+            uint8_t from_upper = 0, from_lower = 0;
+            for (uint32_t i = 0; i < count; ++i) {
+                uint32_t cost = states[i].cost + 3 +
+                    pair_len(states[i].fg == c.top ? 0 : fg_top,
+                             states[i].bg == c.bottom ? 0 : bg_bottom);
+                if (cost < upper.cost) {
+                    upper.cost = cost;
+                    from_upper = (uint8_t)(i << 2 | GLYPH_UPPER);
+                }
+                cost = states[i].cost + 3 +
+                    pair_len(states[i].fg == c.bottom ? 0 : fg_bottom,
+                             states[i].bg == c.top ? 0 : bg_top);
+                if (cost < lower.cost) {
+                    lower.cost = cost;
+                    from_lower = (uint8_t)(i << 2 | GLYPH_LOWER);
+                }
+            }
+            // The foreground is never transparent
+            if (c.top == CELL_TRANSPARENT) {
+                upper.cost = UINT32_MAX;
+            } else if (c.bottom == CELL_TRANSPARENT) {
+                lower.cost = UINT32_MAX;
+            }
+            if (lower.cost < upper.cost) {
+                states[0] = lower;
+                states[1] = upper;
+                from[0] = from_lower;
+                from[1] = from_upper;
+            } else {
+                states[0] = upper;
+                states[1] = lower;
+                from[0] = from_upper;
+                from[1] = from_lower;
+            }
+            count = upper.cost == UINT32_MAX || lower.cost == UINT32_MAX ? 1 : 2;
+            continue;
+        }
+        if (c.top == CELL_TRANSPARENT) {
+            if (blank) {
+                // Skipped, the colors stay as they are
+                for (uint32_t i = 0; i < count; ++i) {
+                    from[i] = (uint8_t)(i << 2 | GLYPH_SPACE);
+                }
+                continue;
+            }
+            // Only a space can draw it
+            for (uint32_t i = 0; i < count; ++i) {
+                if (states[i].bg != CELL_TRANSPARENT) {
+                    states[i].cost += 5;
+                }
+                states[i].bg = CELL_TRANSPARENT;
+                states[i].cost += 1;
+                from[i] = (uint8_t)(i << 2 | GLYPH_SPACE);
+            }
+            if (count == 2 && states[1].cost < states[0].cost) {
+                RowState s = states[0];
+                states[0] = states[1];
+                states[1] = s;
+                uint8_t f = from[0];
+                from[0] = from[1];
+                from[1] = f;
+            }
+            // Both now only differ in cost, keep the cheaper one
+            if (count == 2 && states[0].fg == states[1].fg) {
+                count = 1;
+            }
+            continue;
+        }
+
+        // One color, either as the background of a space or the foreground
+        // of a full block, keeping the other color
+        uint32_t fg_c = fg_len(c.top), bg_c = bg_len_of(c.top, fg_c, dflt);
+        RowState next[2 * ROW_STATES];
+        uint8_t next_from[2 * ROW_STATES];
+        uint32_t next_count = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            RowState space = {states[i].fg, c.top, states[i].cost + 1};
+            if (states[i].bg != c.top) {
+                space.cost += bg_c;
+            }
+            add_state(next, next_from, &next_count, space, i, GLYPH_SPACE);
+            RowState full = {c.top, states[i].bg, states[i].cost + 3};
+            if (states[i].fg != c.top) {
+                full.cost += fg_c;
+            }
+            add_state(next, next_from, &next_count, full, i, GLYPH_FULL);
+        }
+        count = next_count < ROW_STATES ? next_count : ROW_STATES;
+        memcpy(states, next, count * sizeof(RowState));
+        memcpy(from, next_from, count);
+    }
+
+    // Walk back from the cheapest state, leaving the glyph of each cell in
+    // its first entry
+    uint32_t ix = 0;
+    for (uint32_t x = cols; x-- > 0;) {
+        uint8_t step = path[x * ROW_STATES + ix];
+        path[x * ROW_STATES] = step & 3;
+        ix = step >> 2;
+    }
+    for (uint32_t x = 0; x < cols; ++x) {
+        Cell c = cell_key(row[x], colors);
+        if (blank && c.top == CELL_TRANSPARENT && c.bottom == CELL_TRANSPARENT) {
+            uint32_t n = transparent_run(row, x, cols);
+            p = skip_cells(p, x, n, cols);
+            x += n - 1;
+            continue;
+        }
+        uint32_t glyph = path[x * ROW_STATES];
+        p = draw_cell(p, glyph, c, fg, bg, tol, dflt);
+        if (repeat) {
+            // Equal cells drawn with the same glyph need no colors
+            uint32_t n = 0;
+            while (x + 1 + n < cols && path[(x + 1 + n) * ROW_STATES] == glyph &&
+                   cell_equal(cell_key(row[x + 1 + n], colors), c)) {
+                ++n;
+            }
+            if (n > 0) {
+                x += n;
+                p = repeat_glyph(p, glyph_len[glyph], n,
+                                 x + 1 == cols && glyph == GLYPH_SPACE &&
+                                 (*bg == dflt || *bg == CELL_TRANSPARENT));
+            }
+        }
+    }
+    return p;
+}
+
+// Write a row of cells, picking the cheapest glyph for each cell in turn.
+// Colors within `tol` of the current ones are reused. Used for
+// EncodeOptions.greedy.
+static inline char* encode_row_near(char* p, const Cell* row, uint32_t cols,
+                                    uint32_t* fg, uint32_t* bg, uint32_t tol,
+                                    uint32_t dflt, bool repeat, bool blank) {
+    for (uint32_t x = 0; x < cols; ++x) {
+        if (blank && row[x].top == CELL_TRANSPARENT &&
+            row[x].bottom == CELL_TRANSPARENT) {
+            uint32_t n = transparent_run(row, x, cols);
+            p = skip_cells(p, x, n, cols);
+            x += n - 1;
+            continue;
+        }
+        p = encode_cell(p, row[x], fg, bg, tol, dflt);
+        if (repeat) {
+            uint32_t n = run_length(row, x + 1, cols, row[x], ENCODE_TRUECOLOR);
+            if (n > 0) {
+                // The glyph is the last thing written, and only a space is
+                // one byte long
+                uint32_t len = p[-1] == ' ' ? 1 : 3;
+                x += n;
+                p = repeat_glyph(p, len, n, x + 1 == cols && len == 1 &&
+                                            (*bg == dflt ||
+                                             *bg == CELL_TRANSPARENT));
+            }
+        }
+    }
+    return p;
+}
+
+// Color written as "\x1b[49m", or NO_COLOR
+static inline uint32_t default_bg(const EncodeOptions* opts) {
+    if (!opts->has_default_bg || opts->colors != ENCODE_TRUECOLOR) {
+        return NO_COLOR;
+    }
+    return opts->default_bg;
+}
+
+bool encode_rows(String* dest, const CellGrid* grid, uint32_t y0, uint32_t y1,
+                 const EncodeOptions* opts) {
+    uint64_t bound = ansi_frame_bound(grid->cols, y1 - y0, 5, 0);
+    if (!reserve(dest, bound)) {
+        return false;
+    }
+    uint8_t* path = Mem_alloc((size_t)grid->cols * ROW_STATES);
+    if (path == NULL) {
+        return false;
+    }
+    uint32_t dflt = default_bg(opts);
+    bool repeat = opts->repeat;
+    bool blank = opts->blank;
+    char* p = dest->buffer + dest->length;
+    // The colors carry over to the next row, the newline never scrolls
+    // since the frame fits the terminal. A band further down starts after
+    // whatever the band above left.
+    uint32_t fg = NO_COLOR, bg = NO_COLOR;
+    for (uint32_t y = y0; y < y1; ++y) {
+        if (y > 0) {
+            *p++ = '\n';
+        }
+        const Cell* row = grid->cells + y * grid->cols;
+        // Separate loops for each mode, without checks for the others
+        if (opts->colors == ENCODE_256) {
+            p = encode_row(p, row, grid->cols, &fg, &bg, ENCODE_256, 0, dflt,
+                           repeat, blank, path);
+        } else if (opts->colors == ENCODE_16) {
+            p = encode_row(p, row, grid->cols, &fg, &bg, ENCODE_16, 0, dflt,
+                           repeat, blank, path);
+        } else if (opts->greedy) {
+            p = encode_row_near(p, row, grid->cols, &fg, &bg, opts->tolerance,
+                                dflt, repeat, blank);
+        } else if (opts->tolerance == 0) {
+            p = encode_row(p, row, grid->cols, &fg, &bg, ENCODE_TRUECOLOR, 0,
+                           dflt, repeat, blank, path);
+        } else {
+            p = encode_row(p, row, grid->cols, &fg, &bg, ENCODE_TRUECOLOR,
+                           opts->tolerance, dflt, repeat, blank, path);
+        }
+    }
+    Mem_free(path);
+    finish(dest, p);
+    return true;
+}
+
+bool encode_delta_rows(String* dest, const CellGrid* grid, const CellGrid* prev,
+                       uint32_t y0, uint32_t y1, const EncodeOptions* opts) {
+    // Cells are compared with `prev` exactly, so errors from the tolerance
+    // never add up over frames.
+    uint32_t colors = opts->colors;
+    uint32_t tol = colors == ENCODE_TRUECOLOR ? opts->tolerance : 0;
+    // Every changed cell may need a cursor jump, the unchanged cells
+    // repainted to fill a gap always cost less than the jump they replace.
+    uint64_t bound = (uint64_t)grid->cols * (y1 - y0) *
+                     (ANSI_CELL_MAX + CUP_MAX) + ANSI_SLACK;
+    if (!reserve(dest, bound)) {
+        return false;
+    }
+    char* p = dest->buffer + dest->length;
+
+    // The previous frame ends with the default colors, a band further down
+    // starts after whatever the band above left
+    uint32_t dflt = default_bg(opts);
+    uint32_t fg = NO_COLOR, bg = y0 == 0 ? dflt : NO_COLOR;
+    uint32_t cur_row = NO_COLOR, cur_col = 0;
+    for (uint32_t y = y0; y < y1; ++y) {
+        const Cell* row = grid->cells + y * grid->cols;
+        const Cell* prev_row = prev->cells + y * grid->cols;
+        for (uint32_t x = 0; x < grid->cols; ++x) {
+            // In a palette mode a cell is unchanged if it maps to the same
+            // palette entries
+            Cell c = cell_key(row[x], colors);
+            if (cell_equal(c, cell_key(prev_row[x], colors))) {
+                continue;
+            }
+            if (cur_row != y) {
+                p = ansi_cup(p, y + 1, x + 1);
+            } else if (cur_col < x) {
+                // Either jump over the unchanged cells or paint them again
+                uint32_t jump = 3 + ansi_uint_len(x - cur_col);
+                uint32_t cost = 0;
+                uint32_t fg2 = fg, bg2 = bg;
+                for (uint32_t i = cur_col; i < x && cost < jump; ++i) {
+                    cost += cell_cost(cell_key(row[i], colors), &fg2, &bg2,
+                                      tol, dflt);
+                }
+                if (cost < jump) {
+                    for (uint32_t i = cur_col; i < x; ++i) {
+                        p = encode_cell(p, cell_key(row[i], colors), &fg, &bg,
+                                        tol, dflt);
+                    }
+                } else {
+                    p = ansi_cuf(p, x - cur_col);
+                }
+            }
+            p = encode_cell(p, c, &fg, &bg, tol, dflt);
+            if (opts->repeat) {
+                // Repeat the cell over the equal ones after it, up to the
+                // last one that changed
+                uint32_t n = run_length(row, x + 1, grid->cols, c, colors);
+                while (n > 0 && cell_equal(cell_key(prev_row[x + n], colors), c)) {
+                    --n;
+                }
+                if (n > 0) {
+                    uint32_t len = p[-1] == ' ' ? 1 : 3;
+                    p = repeat_glyph(p, len, n, false);
+                    x += n;
+                }
+            }
+            cur_row = y;
+            cur_col = x + 1;
+        }
+    }
+    finish(dest, p);
+    return true;
+}
+
+static bool encode_header(String* dest, const CellGrid* prev) {
+    if (prev == NULL) {
+        return String_append_count(dest, "\x1b[1;1H", 6);
+    }
+    return true;
+}
+
+static bool encode_trailer(String* dest, const CellGrid* grid,
+                           const CellGrid* prev, bool changed) {
+    if (prev == NULL) {
+        return String_append_count(dest, "\x1b[0m", 4);
+    }
+    if (!changed) {
+        return true;
+    }
+    // Leave the cursor where a full frame would
+    if (!reserve(dest, 4 + CUP_MAX + ANSI_SLACK)) {
+        return false;
+    }
+    char* p = dest->buffer + dest->length;
+    memcpy(p, "\x1b[0m", 4);
+    finish(dest, ansi_cup(p + 4, grid->rows, grid->cols));
+    return true;
+}
+
+bool encode_frame(String* dest, const CellGrid* grid, const EncodeOptions* opts) {
+    return encode_header(dest, NULL) &&
+           encode_rows(dest, grid, 0, grid->rows, opts) &&
+           encode_trailer(dest, grid, NULL, true);
+}
+
+bool encode_delta(String* dest, const CellGrid* grid, const CellGrid* prev,
+                  const EncodeOptions* opts) {
+    string_size_t start = dest->length;
+    if (!encode_delta_rows(dest, grid, prev, 0, grid->rows, opts)) {
+        return false;
+    }
+    return encode_trailer(dest, grid, prev, dest->length != start);
+}
+
+typedef struct EncodeJob {
+    const CellGrid* grid;
+    const CellGrid* prev;
+    const EncodeOptions* opts;
+    String* bands;
+    uint32_t band_rows;
+    bool failed;
+} EncodeJob;
+
+static void encode_band(void* arg, uint32_t ix) {
+    EncodeJob* job = arg;
+    uint32_t y0 = ix * job->band_rows;
+    uint32_t y1 = y0 + job->band_rows;
+    if (y1 > job->grid->rows) {
+        y1 = job->grid->rows;
+    }
+    String_clear(&job->bands[ix]);
+    bool status;
+    if (job->prev == NULL) {
+        status = encode_rows(&job->bands[ix], job->grid, y0, y1, job->opts);
+    } else {
+        status = encode_delta_rows(&job->bands[ix], job->grid, job->prev, y0, y1,
+                                   job->opts);
+    }
+    if (!status) {
+        job->failed = true;
+    }
+}
+
+bool encode_parallel(String* dest, const CellGrid* grid, const CellGrid* prev,
+                     WorkPool* pool, String* bands, uint32_t band_count,
+                     const EncodeOptions* opts) {
+    EncodeJob job = {grid, prev, opts, bands, 0, false};
+    job.band_rows = (grid->rows + band_count - 1) / band_count;
+    if (job.band_rows == 0) {
+        job.band_rows = 1;
+    }
+    band_count = (grid->rows + job.band_rows - 1) / job.band_rows;
+    WorkPool_run(pool, encode_band, &job, band_count);
+    if (job.failed || !encode_header(dest, prev)) {
+        return false;
+    }
+
+    string_size_t start = dest->length;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < band_count; ++i) {
+        total += bands[i].length;
+    }
+    if (!reserve(dest, total)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < band_count; ++i) {
+        memcpy(dest->buffer + dest->length, bands[i].buffer, bands[i].length);
+        dest->length += bands[i].length;
+    }
+    dest->buffer[dest->length] = '\0';
+    return encode_trailer(dest, grid, prev, dest->length != start);
+}
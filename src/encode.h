@@ -0,0 +1,130 @@
+#ifndef ENCODE_H_00
+#define ENCODE_H_00
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dynamic_string.h"
+#include "workpool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Colors are stored as r | g << 8 | b << 16
+#define CELL_RGB(r, g, b) ((uint32_t)(r) | ((uint32_t)(g) << 8) | \
+                           ((uint32_t)(b) << 16))
+#define CELL_R(c) ((uint8_t)(c))
+#define CELL_G(c) ((uint8_t)((c) >> 8))
+#define CELL_B(c) ((uint8_t)((c) >> 16))
+
+// Color of a fully transparent pixel. It is drawn in the terminal's own
+// background, and cells that are transparent in both halves can be left
+// unpainted, see EncodeOptions.blank.
+#define CELL_TRANSPARENT 0x04000000
+
+// One terminal cell, showing two vertically stacked pixels
+typedef struct Cell {
+    uint32_t top;
+    uint32_t bottom;
+} Cell;
+
+typedef struct CellGrid {
+    Cell* cells;
+    uint32_t cols;
+    uint32_t rows;
+} CellGrid;
+
+typedef CellGrid CellGrid_noinit;
+
+// Color modes of EncodeOptions
+// 24 bit colors, "\x1b[38;2;R;G;Bm"
+#define ENCODE_TRUECOLOR 0
+// Entries 16-255 of the xterm palette, "\x1b[38;5;Nm"
+#define ENCODE_256 1
+// The 16 basic colors, "\x1b[3Nm"
+#define ENCODE_16 2
+
+// How cells are turned into escape sequences. Zero initialized options
+// encode every color exactly.
+typedef struct EncodeOptions {
+    // A cell keeps the current foreground or background color when its own
+    // color is within this perceptual distance of it, so fewer colors are
+    // written. A distance of n is about a difference of n in every channel.
+    // Only used with ENCODE_TRUECOLOR.
+    uint32_t tolerance;
+    // One of the ENCODE_ color modes. The palette modes need palette_init
+    // to have been called.
+    uint32_t colors;
+    // Set when the terminal is known to show `default_bg` as its default
+    // background, so "\x1b[49m" can be written for it. Only used with
+    // ENCODE_TRUECOLOR.
+    bool has_default_bg;
+    uint32_t default_bg;
+    // Write runs of equal cells with REP, "\x1b[Nb", which repeats the last
+    // character. Not all terminals support it.
+    bool repeat;
+    // Pick the glyph of each cell in turn instead of searching each row
+    // for the shortest sequence. Faster, but writes more bytes. Only used
+    // with ENCODE_TRUECOLOR.
+    bool greedy;
+    // Set when full frames are written over a cleared screen, so fully
+    // transparent cells can be skipped instead of painted
+    bool blank;
+} EncodeOptions;
+
+// Create a grid of `cols` x `rows` cells
+bool CellGrid_create(CellGrid_noinit* grid, uint32_t cols, uint32_t rows);
+
+// Free a grid
+void CellGrid_free(CellGrid* grid);
+
+// Fill `grid` from `pixel_rows` rows of grid->cols opaque RGBA pixels.
+// A missing bottom row is filled with black.
+void CellGrid_from_rgba(CellGrid* grid, const uint8_t* rgba, uint32_t pixel_rows);
+
+// Same as CellGrid_from_rgba, but only fills the cell rows [y0, y1)
+void CellGrid_from_rgba_rows(CellGrid* grid, const uint8_t* rgba,
+                             uint32_t pixel_rows, uint32_t y0, uint32_t y1);
+
+// Keep only the top `bits` bits of each color channel in the cell rows
+// [y0, y1). The dropped bits repeat the kept ones, so black and white stay
+// exact. Needs at least 4 bits.
+void CellGrid_quantize_rows(CellGrid* grid, uint32_t bits, uint32_t y0, uint32_t y1);
+
+// Set the pixels of the cell rows [y0, y1) whose entry in `alpha` is 0 to
+// CELL_TRANSPARENT. `alpha` holds one byte for each of `pixel_rows` rows
+// of grid->cols pixels. Call after quantizing.
+void CellGrid_mark_transparent_rows(CellGrid* grid, const uint8_t* alpha,
+                                    uint32_t pixel_rows, uint32_t y0, uint32_t y1);
+
+// Append the encoding of the cell rows [y0, y1) of `grid`. Each row after
+// the first row of the grid starts with a row separator, so the rows of a
+// grid can be encoded in independent pieces and concatenated.
+bool encode_rows(String* dest, const CellGrid* grid, uint32_t y0, uint32_t y1,
+                 const EncodeOptions* opts);
+
+// Append the cells in rows [y0, y1) of `grid` that differ from `prev`.
+// Starts with no assumption about cursor position or colors.
+bool encode_delta_rows(String* dest, const CellGrid* grid, const CellGrid* prev,
+                       uint32_t y0, uint32_t y1, const EncodeOptions* opts);
+
+// Append escape sequences painting `grid` at the top left of the terminal
+bool encode_frame(String* dest, const CellGrid* grid, const EncodeOptions* opts);
+
+// Append escape sequences repainting only the cells of `grid` that differ
+// from `prev`. `prev` must be the same size and be what is on screen.
+bool encode_delta(String* dest, const CellGrid* grid, const CellGrid* prev,
+                  const EncodeOptions* opts);
+
+// Same as encode_frame, or encode_delta if `prev` is not NULL, but encodes
+// bands of rows on `pool`. `bands` holds `band_count` created strings
+// used as scratch space, reused between calls.
+bool encode_parallel(String* dest, const CellGrid* grid, const CellGrid* prev,
+                     WorkPool* pool, String* bands, uint32_t band_count,
+                     const EncodeOptions* opts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
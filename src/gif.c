@@ -0,0 +1,337 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <string.h>
+
+#include "gif.h"
+#include "mem.h"
+
+#define LZW_MAX_CODES 4096
+
+struct GifDecoder {
+    FILE* file;
+    uint32_t width;
+    uint32_t height;
+
+    uint8_t* canvas;
+    // Copy of the canvas, for frames disposed by restoring the previous one
+    uint8_t* saved;
+
+    uint8_t global_palette[256 * 3];
+    uint32_t global_colors;
+    uint8_t local_palette[256 * 3];
+
+    // How the last frame is disposed before drawing the next one
+    uint32_t disposal;
+    uint32_t left, top, frame_w, frame_h;
+
+    // LZW bit reader over the image data sub-blocks
+    uint32_t bits;
+    uint32_t bit_count;
+    uint32_t block_left;
+    bool data_end;
+
+    uint16_t prefix[LZW_MAX_CODES];
+    uint8_t suffix[LZW_MAX_CODES];
+    uint8_t stack[LZW_MAX_CODES + 1];
+};
+
+static uint32_t read_u16(FILE* f) {
+    int lo = getc(f);
+    int hi = getc(f);
+    if (lo == EOF || hi == EOF) {
+        return 0;
+    }
+    return (uint32_t)lo | ((uint32_t)hi << 8);
+}
+
+// Skip data sub-blocks up to and including the terminating empty block
+static bool skip_blocks(FILE* f) {
+    int len;
+    while ((len = getc(f)) > 0) {
+        if (fseek(f, len, SEEK_CUR) != 0) {
+            return false;
+        }
+    }
+    return len == 0;
+}
+
+GifDecoder* Gif_open(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    uint8_t header[13];
+    if (fread(header, 1, 13, f) != 13 ||
+        (memcmp(header, "GIF87a", 6) != 0 && memcmp(header, "GIF89a", 6) != 0)) {
+        fclose(f);
+        return NULL;
+    }
+    GifDecoder* gif = Mem_alloc(sizeof(GifDecoder));
+    if (gif == NULL) {
+        fclose(f);
+        return NULL;
+    }
+    memset(gif, 0, sizeof(GifDecoder));
+    gif->file = f;
+    gif->width = header[6] | (header[7] << 8);
+    gif->height = header[8] | (header[9] << 8);
+    if (header[10] & 0x80) {
+        gif->global_colors = 2u << (header[10] & 7);
+        if (fread(gif->global_palette, 3, gif->global_colors, f) !=
+            gif->global_colors) {
+            Gif_close(gif);
+            return NULL;
+        }
+    }
+    size_t size = (size_t)gif->width * gif->height * 4;
+    gif->canvas = Mem_alloc(size ? size : 4);
+    if (gif->canvas == NULL) {
+        Gif_close(gif);
+        return NULL;
+    }
+    memset(gif->canvas, 0, size);
+    return gif;
+}
+
+void Gif_close(GifDecoder* gif) {
+    if (gif == NULL) {
+        return;
+    }
+    fclose(gif->file);
+    if (gif->canvas != NULL) {
+        Mem_free(gif->canvas);
+    }
+    if (gif->saved != NULL) {
+        Mem_free(gif->saved);
+    }
+    Mem_free(gif);
+}
+
+uint32_t Gif_width(const GifDecoder* gif) {
+    return gif->width;
+}
+
+uint32_t Gif_height(const GifDecoder* gif) {
+    return gif->height;
+}
+
+// Read a `size` bit LZW code. Returns -1 when the data runs out.
+static int read_code(GifDecoder* gif, uint32_t size) {
+    while (gif->bit_count < size) {
+        if (gif->block_left == 0) {
+            int len = gif->data_end ? 0 : getc(gif->file);
+            if (len <= 0) {
+                gif->data_end = true;
+                return -1;
+            }
+            gif->block_left = len;
+        }
+        int c = getc(gif->file);
+        if (c == EOF) {
+            gif->data_end = true;
+            return -1;
+        }
+        --gif->block_left;
+        gif->bits |= (uint32_t)c << gif->bit_count;
+        gif->bit_count += 8;
+    }
+    int code = gif->bits & ((1u << size) - 1);
+    gif->bits >>= size;
+    gif->bit_count -= size;
+    return code;
+}
+
+// Decode the image data of the current frame onto the canvas
+static bool decode_image(GifDecoder* gif, const uint8_t* palette,
+                         uint32_t colors, bool interlaced, int transparent) {
+    int min_size = getc(gif->file);
+    if (min_size < 1 || min_size > 11) {
+        return false;
+    }
+    gif->bits = 0;
+    gif->bit_count = 0;
+    gif->block_left = 0;
+    gif->data_end = false;
+
+    const uint32_t clear = 1u << min_size;
+    const uint32_t eoi = clear + 1;
+    for (uint32_t i = 0; i < clear; ++i) {
+        gif->suffix[i] = i;
+        gif->prefix[i] = 0;
+    }
+    uint32_t size = min_size + 1;
+    uint32_t next = eoi + 1;
+    int prev = -1;
+    uint8_t first = 0;
+
+    uint64_t total = (uint64_t)gif->frame_w * gif->frame_h;
+    uint64_t pos = 0;
+    // Output row, stepping through the interlace passes if needed
+    uint32_t x = 0, y = 0, pass = 0;
+    static const uint8_t pass_start[4] = {0, 4, 2, 1};
+    static const uint8_t pass_step[4] = {8, 8, 4, 2};
+    uint32_t step = interlaced ? 8 : 1;
+
+    while (pos < total) {
+        int code = read_code(gif, size);
+        if (code < 0 || (uint32_t)code == eoi) {
+            break;
+        }
+        if ((uint32_t)code == clear) {
+            size = min_size + 1;
+            next = eoi + 1;
+            prev = -1;
+            continue;
+        }
+        uint32_t sp = 0;
+        if (prev < 0) {
+            if ((uint32_t)code >= clear) {
+                return false;
+            }
+            first = code;
+            gif->stack[sp++] = first;
+        } else {
+            uint32_t in_code = code;
+            uint32_t c = code;
+            if (c > next) {
+                return false;
+            }
+            if (c == next) {
+                gif->stack[sp++] = first;
+                c = prev;
+            }
+            while (c >= clear) {
+                gif->stack[sp++] = gif->suffix[c];
+                c = gif->prefix[c];
+            }
+            first = c;
+            gif->stack[sp++] = first;
+            if (next < LZW_MAX_CODES) {
+                gif->prefix[next] = prev;
+                gif->suffix[next] = first;
+                ++next;
+                if (next == (1u << size) && size < 12) {
+                    ++size;
+                }
+            }
+            code = in_code;
+        }
+        prev = code;
+
+        while (sp > 0 && pos < total) {
+            uint8_t ix = gif->stack[--sp];
+            uint32_t cx = gif->left + x;
+            uint32_t cy = gif->top + y;
+            if (ix != transparent && ix < colors && cx < gif->width &&
+                cy < gif->height) {
+                uint8_t* px = gif->canvas + ((size_t)cy * gif->width + cx) * 4;
+                px[0] = palette[3 * ix];
+                px[1] = palette[3 * ix + 1];
+                px[2] = palette[3 * ix + 2];
+                px[3] = 0xff;
+            }
+            ++pos;
+            if (++x == gif->frame_w) {
+                x = 0;
+                y += step;
+                while (interlaced && y >= gif->frame_h && pass < 3) {
+                    ++pass;
+                    y = pass_start[pass];
+                    step = pass_step[pass];
+                }
+            }
+        }
+    }
+    if (!gif->data_end) {
+        fseek(gif->file, gif->block_left, SEEK_CUR);
+        skip_blocks(gif->file);
+    }
+    return true;
+}
+
+// Undo the last frame as its disposal method asks
+static void dispose(GifDecoder* gif) {
+    if (gif->disposal == 2) {
+        for (uint32_t y = gif->top; y < gif->top + gif->frame_h && y < gif->height; ++y) {
+            uint32_t x0 = gif->left < gif->width ? gif->left : gif->width;
+            uint32_t x1 = gif->left + gif->frame_w < gif->width ?
+                          gif->left + gif->frame_w : gif->width;
+            memset(gif->canvas + ((size_t)y * gif->width + x0) * 4, 0, (x1 - x0) * 4);
+        }
+    } else if (gif->disposal == 3 && gif->saved != NULL) {
+        memcpy(gif->canvas, gif->saved, (size_t)gif->width * gif->height * 4);
+    }
+    gif->disposal = 0;
+}
+
+int Gif_next_frame(GifDecoder* gif, const uint8_t** rgba, uint32_t* delay) {
+    FILE* f = gif->file;
+    uint32_t disposal = 0;
+    int transparent = -1;
+    *delay = 0;
+
+    dispose(gif);
+    while (1) {
+        int c = getc(f);
+        if (c == EOF || c == 0x3b) {
+            return 0;
+        } else if (c == 0x21) {
+            int label = getc(f);
+            if (label == 0xf9) {
+                // Graphic control extension
+                int len = getc(f);
+                int packed = getc(f);
+                uint32_t d = read_u16(f);
+                int index = getc(f);
+                if (len != 4 || index == EOF) {
+                    return -1;
+                }
+                disposal = (packed >> 2) & 7;
+                transparent = (packed & 1) ? index : -1;
+                *delay = d * 10;
+            }
+            if (!skip_blocks(f)) {
+                return -1;
+            }
+        } else if (c == 0x2c) {
+            break;
+        } else {
+            return -1;
+        }
+    }
+
+    gif->left = read_u16(f);
+    gif->top = read_u16(f);
+    gif->frame_w = read_u16(f);
+    gif->frame_h = read_u16(f);
+    int packed = getc(f);
+    if (packed == EOF) {
+        return -1;
+    }
+    const uint8_t* palette = gif->global_palette;
+    uint32_t colors = gif->global_colors;
+    if (packed & 0x80) {
+        colors = 2u << (packed & 7);
+        if (fread(gif->local_palette, 3, colors, f) != colors) {
+            return -1;
+        }
+        palette = gif->local_palette;
+    }
+
+    if (disposal == 3) {
+        size_t size = (size_t)gif->width * gif->height * 4;
+        if (gif->saved == NULL) {
+            gif->saved = Mem_alloc(size ? size : 4);
+            if (gif->saved == NULL) {
+                return -1;
+            }
+        }
+        memcpy(gif->saved, gif->canvas, size);
+    }
+    if (!decode_image(gif, palette, colors, (packed & 0x40) != 0, transparent)) {
+        return -1;
+    }
+    gif->disposal = disposal;
+    *rgba = gif->canvas;
+    return 1;
+}
@@ -0,0 +1,34 @@
+#ifndef GIF_H_00
+#define GIF_H_00
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Decodes a GIF one frame at a time, keeping only the current canvas
+// (and the one before it, for frames disposed by restoring it) in memory.
+typedef struct GifDecoder GifDecoder;
+
+// Open the GIF file at `path`. Returns NULL if it cannot be read or is not
+// a GIF.
+GifDecoder* Gif_open(const char* path);
+
+// Close a decoder
+void Gif_close(GifDecoder* gif);
+
+// Size of the canvas in pixels
+uint32_t Gif_width(const GifDecoder* gif);
+uint32_t Gif_height(const GifDecoder* gif);
+
+// Decode the next frame. On success `rgba` points to the RGBA32 canvas,
+// valid until the next call, and `delay` gets the frame time in ms.
+// Returns 1 for a frame, 0 at the end of the file and -1 on error.
+int Gif_next_frame(GifDecoder* gif, const uint8_t** rgba, uint32_t* delay);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+#include <string.h>
+
+#include "hysteresis.h"
+#include "mem.h"
+
+bool Hysteresis_create(Hysteresis_noinit* h, uint32_t cols, uint32_t rows,
+                       uint32_t threshold, uint32_t frames) {
+    // One byte of age and one of sign for each half cell
+    h->age = Mem_alloc((size_t)cols * rows * 4);
+    if (h->age == NULL) {
+        return false;
+    }
+    memset(h->age, 0, (size_t)cols * rows * 4);
+    h->sign = h->age + (size_t)cols * rows * 2;
+    h->threshold = threshold;
+    h->frames = frames < 255 ? frames : 255;
+    h->cols = 0;
+    h->rows = 0;
+    return true;
+}
+
+void Hysteresis_free(Hysteresis* h) {
+    Mem_free(h->age);
+    h->age = NULL;
+    h->sign = NULL;
+}
+
+static inline uint32_t channel_diff(uint8_t a, uint8_t b) {
+    return a > b ? a - b : b - a;
+}
+
+// Direction of the change from `b` to `a` in each channel, bit 2n set if
+// channel n went up and bit 2n + 1 if it went down
+static inline uint8_t change_sign(uint32_t a, uint32_t b) {
+    uint8_t sign = 0;
+    for (uint32_t i = 0; i < 24; i += 8) {
+        uint8_t x = (uint8_t)(a >> i), y = (uint8_t)(b >> i);
+        sign |= (x > y) << (i / 4);
+        sign |= (x < y) << (i / 4 + 1);
+    }
+    return sign;
+}
+
+// Whether a channel went up in one of `a` and `b` and down in the other
+static inline bool sign_flipped(uint8_t a, uint8_t b) {
+    return ((a & 0x15) & (b >> 1)) != 0 || ((b & 0x15) & (a >> 1)) != 0;
+}
+
+// Filter one half cell, returning the color to show. Only a change that
+// keeps its direction counts towards `frames`: noise that swings back and
+// forth around the shown color starts over every time it turns, while a
+// real change slowly drifting in shows after `frames` frames. A change
+// over the threshold shows at once and also starts over.
+static inline uint32_t hold(const Hysteresis* h, uint8_t* age, uint8_t* sign,
+                            uint32_t c, uint32_t shown) {
+    if (c == shown) {
+        *age = 0;
+        *sign = 0;
+        return c;
+    }
+    // Transparency always shows at once
+    bool near = ((c | shown) >> 24) == 0 &&
+                channel_diff(CELL_R(c), CELL_R(shown)) <= h->threshold &&
+                channel_diff(CELL_G(c), CELL_G(shown)) <= h->threshold &&
+                channel_diff(CELL_B(c), CELL_B(shown)) <= h->threshold;
+    if (!near) {
+        *age = 0;
+        *sign = 0;
+        return c;
+    }
+    uint8_t s = change_sign(c, shown);
+    if (sign_flipped(s, *sign)) {
+        *age = 0;
+    }
+    *sign = s;
+    if (++*age >= h->frames) {
+        *age = 0;
+        *sign = 0;
+        return c;
+    }
+    return shown;
+}
+
+void Hysteresis_apply(Hysteresis* h, CellGrid* grid, const CellGrid* shown) {
+    uint32_t count = grid->cols * grid->rows;
+    if (grid->cols != shown->cols || grid->rows != shown->rows ||
+        grid->cols != h->cols || grid->rows != h->rows) {
+        memset(h->age, 0, (size_t)count * 2);
+        memset(h->sign, 0, (size_t)count * 2);
+        h->cols = grid->cols;
+        h->rows = grid->rows;
+        if (grid->cols != shown->cols || grid->rows != shown->rows) {
+            return;
+        }
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        Cell* c = &grid->cells[i];
+        const Cell* s = &shown->cells[i];
+        c->top = hold(h, &h->age[2 * i], &h->sign[2 * i], c->top, s->top);
+        c->bottom = hold(h, &h->age[2 * i + 1], &h->sign[2 * i + 1],
+                         c->bottom, s->bottom);
+    }
+}
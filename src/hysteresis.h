@@ -0,0 +1,47 @@
+#ifndef HYSTERESIS_H_00
+#define HYSTERESIS_H_00
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "encode.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Keeps each half cell at the color it was last shown with until the new
+// color differs by more than `threshold` in some channel, or has differed
+// in the same direction for `frames` frames in a row. Hides the small
+// changes camera noise makes in every frame, so unchanged parts of the
+// picture are not written again.
+typedef struct Hysteresis {
+    uint32_t threshold;
+    uint32_t frames;
+    // Frames each half cell has differed from the shown color, and the
+    // direction of the difference in each channel, see hold in
+    // hysteresis.c
+    uint8_t* age;
+    uint8_t* sign;
+    uint32_t cols;
+    uint32_t rows;
+} Hysteresis;
+
+typedef Hysteresis Hysteresis_noinit;
+
+// Create a filter for grids of up to `cols` x `rows` cells. `frames` is
+// at most 255.
+bool Hysteresis_create(Hysteresis_noinit* h, uint32_t cols, uint32_t rows,
+                       uint32_t threshold, uint32_t frames);
+
+void Hysteresis_free(Hysteresis* h);
+
+// Set the colors of `grid` that have not changed enough from `shown`, the
+// grid written before it, back to the shown ones. If the grids differ in
+// size nothing is kept and the filter starts over.
+void Hysteresis_apply(Hysteresis* h, CellGrid* grid, const CellGrid* shown);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+#include <stdlib.h>
+
+#include "latency.h"
+#include "mem.h"
+
+bool Latency_create(Latency_noinit* l, uint32_t stage_count,
+                    const char* const* names) {
+    if (stage_count == 0 || stage_count > LATENCY_STAGES_MAX) {
+        return false;
+    }
+    l->samples = Mem_alloc((stage_count + 1) * LATENCY_WINDOW * sizeof(uint64_t));
+    if (l->samples == NULL) {
+        return false;
+    }
+    l->stage_count = stage_count;
+    for (uint32_t i = 0; i < stage_count; ++i) {
+        l->names[i] = names[i];
+    }
+    l->frames = 0;
+    return true;
+}
+
+void Latency_free(Latency* l) {
+    Mem_free(l->samples);
+    l->samples = NULL;
+}
+
+void Latency_add(Latency* l, const uint64_t* stamps) {
+    uint64_t ix = l->frames % LATENCY_WINDOW;
+    for (uint32_t i = 0; i < l->stage_count; ++i) {
+        // A stage that was skipped leaves its stamp at the one before
+        uint64_t d = stamps[i + 1] > stamps[i] ? stamps[i + 1] - stamps[i] : 0;
+        l->samples[i * LATENCY_WINDOW + ix] = d;
+    }
+    uint64_t total = stamps[l->stage_count] > stamps[0]
+                         ? stamps[l->stage_count] - stamps[0] : 0;
+    l->samples[l->stage_count * LATENCY_WINDOW + ix] = total;
+    ++l->frames;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// `sorted` holds `count` values in ascending order
+static double percentile_ms(const uint64_t* sorted, uint64_t count, uint32_t p) {
+    uint64_t ix = (count * p + 99) / 100;
+    ix = ix > 0 ? ix - 1 : 0;
+    return sorted[ix] / 1e6;
+}
+
+bool Latency_report(const Latency* l, String* dest) {
+    uint64_t count = l->frames < LATENCY_WINDOW ? l->frames : LATENCY_WINDOW;
+    if (!String_format_append(dest, "Latency of the last %llu of %llu frames, ms\n"
+                              "%-8s %8s %8s %8s %8s %8s\n",
+                              (unsigned long long)count,
+                              (unsigned long long)l->frames,
+                              "", "mean", "p50", "p90", "p99", "max")) {
+        return false;
+    }
+    if (count == 0) {
+        return true;
+    }
+    uint64_t* sorted = Mem_alloc(count * sizeof(uint64_t));
+    if (sorted == NULL) {
+        return false;
+    }
+    bool ok = true;
+    for (uint32_t i = 0; i <= l->stage_count && ok; ++i) {
+        uint64_t sum = 0;
+        for (uint64_t j = 0; j < count; ++j) {
+            sorted[j] = l->samples[i * LATENCY_WINDOW + j];
+            sum += sorted[j];
+        }
+        qsort(sorted, count, sizeof(uint64_t), cmp_u64);
+        ok = String_format_append(dest, "%-8s %8.2f %8.2f %8.2f %8.2f %8.2f\n",
+                                  i < l->stage_count ? l->names[i] : "total",
+                                  sum / 1e6 / count,
+                                  percentile_ms(sorted, count, 50),
+                                  percentile_ms(sorted, count, 90),
+                                  percentile_ms(sorted, count, 99),
+                                  sorted[count - 1] / 1e6);
+    }
+    Mem_free(sorted);
+    return ok;
+}
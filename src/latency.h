@@ -0,0 +1,47 @@
+#ifndef LATENCY_H_00
+#define LATENCY_H_00
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dynamic_string.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LATENCY_STAGES_MAX 8
+// Percentiles are taken over this many of the newest frames
+#define LATENCY_WINDOW 4096
+
+// Collects how long frames spend in each stage of a pipeline, from the
+// moment they were captured to the moment they were written
+typedef struct Latency {
+    uint32_t stage_count;
+    const char* names[LATENCY_STAGES_MAX];
+    // Time in ns spent in each stage and in total, LATENCY_WINDOW frames
+    // per stage, written round robin
+    uint64_t* samples;
+    uint64_t frames;
+} Latency;
+
+typedef Latency Latency_noinit;
+
+// Create a log for a pipeline of `stage_count` stages named by `names`,
+// which must outlive it
+bool Latency_create(Latency_noinit* l, uint32_t stage_count,
+                    const char* const* names);
+
+void Latency_free(Latency* l);
+
+// Record a frame. `stamps` holds stage_count + 1 times in ns: when the
+// frame was captured and when each stage was done with it.
+void Latency_add(Latency* l, const uint64_t* stamps);
+
+// Append a table of percentiles in ms for each stage and the total
+bool Latency_report(const Latency* l, String* dest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
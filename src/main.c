@@ -2,6 +2,8 @@
 #include <SDL3_image/SDL_image.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #ifdef _WIN32
@@ -13,10 +15,32 @@
 #endif
 
 #include "dynamic_string.h"
+#include "encode.h"
+#include "downsample.h"
+#include "render.h"
+#include "ansi.h"
+#include "gif.h"
+#include "pacer.h"
+#include "quality.h"
+#include "palette.h"
 
 const char* filename = "apple.png";
 
-void get_background_color(uint8_t* r, uint8_t* g, uint8_t* b) {
+static const char usage[] =
+    "Usage: %s [options] [file]\n"
+    "  -d, --delta          Only repaint the cells that changed. Fully\n"
+    "                       transparent cells are only skipped in every\n"
+    "                       frame with this, otherwise just in the first.\n"
+    "  -s, --stats          Print timing statistics at the end\n"
+    "  -f, --fixed-quality  Never lower the quality to keep up\n"
+    "      --repeat         Repeat equal cells with REP, \"\\x1b[Nb\"\n"
+    "  -t, --tolerance N    Reuse colors within N of the current ones\n"
+    "  -c, --colors N       Use 256 or 16 colors instead of 24 bit color\n"
+    "  -j, --jobs N         Convert on N threads, 0 for one per cpu\n"
+    "  -m, --memory MB      Memory for frames converted ahead\n";
+
+// Returns false when the color is only a guess
+bool get_background_color(uint8_t* r, uint8_t* g, uint8_t* b) {
     *r = 12;
     *g = 12;
     *b = 12;
@@ -25,7 +49,7 @@ void get_background_color(uint8_t* r, uint8_t* g, uint8_t* b) {
     if (GetFileType(h) != FILE_TYPE_CHAR) {
         h = GetStdHandle(STD_ERROR_HANDLE);
         if (GetFileType(h) != FILE_TYPE_CHAR) {
-            return;
+            return false;
         }
     }
     CONSOLE_SCREEN_BUFFER_INFOEX csbiex;
@@ -41,8 +65,10 @@ void get_background_color(uint8_t* r, uint8_t* g, uint8_t* b) {
         *r = GetRValue(bgColor);
         *g = GetGValue(bgColor);
         *b = GetBValue(bgColor);
+        return true;
     }
 #endif
+    return false;
 }
 
 void get_console_size(int* w, int* h) {
@@ -75,112 +101,386 @@ void get_console_size(int* w, int* h) {
 #endif
 }
 
-uint8_t add_alhpa(int32_t c, int32_t a, int32_t bg) {
-    return c + ((0xff - a) * (bg - c)) / 255;
+// SDL formats the render core reads directly
+static const struct {
+    SDL_PixelFormat sdl;
+    uint32_t format;
+} render_formats[] = {
+    {SDL_PIXELFORMAT_RGBA32, RENDER_RGBA}, {SDL_PIXELFORMAT_BGRA32, RENDER_BGRA},
+    {SDL_PIXELFORMAT_ARGB32, RENDER_ARGB}, {SDL_PIXELFORMAT_ABGR32, RENDER_ABGR},
+    {SDL_PIXELFORMAT_RGBX32, RENDER_RGBX}, {SDL_PIXELFORMAT_BGRX32, RENDER_BGRX},
+    {SDL_PIXELFORMAT_XRGB32, RENDER_XRGB}, {SDL_PIXELFORMAT_XBGR32, RENDER_XBGR},
+    {SDL_PIXELFORMAT_RGB24, RENDER_RGB}, {SDL_PIXELFORMAT_BGR24, RENDER_BGR},
+    {SDL_PIXELFORMAT_IYUV, RENDER_I420}, {SDL_PIXELFORMAT_NV12, RENDER_NV12},
+    {SDL_PIXELFORMAT_YUY2, RENDER_YUY2},
+};
+
+// Layout of `format` for the render core, or -1 if it has to be converted
+static int render_format(SDL_PixelFormat format) {
+    uint32_t count = sizeof(render_formats) / sizeof(render_formats[0]);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (render_formats[i].sdl == format) {
+            return render_formats[i].format;
+        }
+    }
+    return -1;
 }
 
-void sample_pixel(SDL_Surface* s, uint32_t x, uint32_t y, uint32_t scale, 
-                  uint8_t* r, uint8_t* g, uint8_t* b, uint8_t* a) {
-    uint64_t r_sum = 0;
-    uint64_t g_sum = 0;
-    uint64_t b_sum = 0;
-    uint64_t a_sum = 0;
-    uint64_t count = 0;
-    for (uint64_t px = 0; px < scale; ++px) {
-        for (uint64_t py = 0; py < scale; ++py) {
-            if (x + px > s->w || y + py > s->h) {
-                continue;
-            }
-            ++count;
-            uint8_t r, g, b, a;
-            SDL_ReadSurfacePixel(s, x, y, &r, &g, &b, &a);
-            r_sum += r;
-            g_sum += g;
-            b_sum += b;
-            a_sum += a;
+// Get a locked version of `s` in a layout the render core reads,
+// converting it to RGBA32 if needed, and describe it in `img`.
+// Release it with unlock_image.
+SDL_Surface* lock_image(SDL_Surface* s, RenderImage* img) {
+    SDL_Surface* src = s;
+    int format = render_format(s->format);
+    if (format < 0) {
+        src = SDL_ConvertSurface(s, SDL_PIXELFORMAT_RGBA32);
+        if (src == NULL) {
+            return NULL;
+        }
+        format = RENDER_RGBA;
+    }
+    if (!SDL_LockSurface(src)) {
+        if (src != s) {
+            SDL_DestroySurface(src);
         }
+        return NULL;
     }
-    *r = r_sum / count;
-    *g = g_sum / count;
-    *b = b_sum / count;
-    *a = a_sum / count;
+    *img = RenderImage_from(src->pixels, src->w, src->h, src->pitch, format);
+    return src;
 }
 
+void unlock_image(SDL_Surface* s, SDL_Surface* src) {
+    SDL_UnlockSurface(src);
+    if (src != s) {
+        SDL_DestroySurface(src);
+    }
+}
+
+// Downsample `s` and store its cells in `grid`
+bool sample_frame(const Renderer* r, SDL_Surface* s, CellGrid* grid) {
+    RenderImage img;
+    SDL_Surface* src = lock_image(s, &img);
+    if (src == NULL) {
+        return false;
+    }
+    bool status = Renderer_sample(r, &img, grid);
+    unlock_image(s, src);
+    if (!status) {
+        SDL_SetError("Out of memory");
+    }
+    return status;
+}
 
-void convert_frame(String* dest, SDL_Surface* s, int scale, SDL_Color bg) {
-    int pw = (s->w + scale - 1) / scale;
-    int ph = (s->h + scale - 1) / scale;
-    ph = (ph + 1) / 2;
-
-    for (uint32_t y = 0; y < ph; ++y) {
-        String_format_append(dest, "\x1b[0m\n");
-        uint32_t last_rgb1 = 0xffffffff, last_rgb2 = 0xffffffff;
-        for (uint32_t x = 0; x < pw; ++x) {
-            uint8_t r1, g1, b1, a1;
-            uint8_t r2 = 0, g2 = 0, b2 = 0, a2 = 0;
-            sample_pixel(s, x * scale, 2 * y * scale, scale, &r1, &g1, &b1, &a1);
-            r1 = add_alhpa(r1, a1, bg.r);
-            g1 = add_alhpa(g1, a1, bg.g);
-            b1 = add_alhpa(b1, a1, bg.b);
-            if ((2 * y + 1) * scale < s->h) {
-                sample_pixel(s, x * scale, (2 * y + 1) * scale, 
-                             scale, &r2, &g2, &b2, &a2);
-                r2 = add_alhpa(r2, a2, bg.r);
-                g2 = add_alhpa(g2, a2, bg.g);
-                b2 = add_alhpa(b2, a2, bg.b);
+// Append escape sequences for `grid` to `dest`.
+// If `prev` is not NULL only cells that differ from it are painted.
+bool encode_grid(const Renderer* r, String* dest, const CellGrid* grid,
+                 const CellGrid* prev) {
+    if (!Renderer_encode(r, dest, grid, prev)) {
+        SDL_SetError("Out of memory");
+        return false;
+    }
+    return true;
+}
+
+// Convert `s` into escape sequences appended to `dest`.
+// The cells are stored in `grid`. If `prev` is not NULL only cells that
+// differ from it are painted.
+bool convert_frame(const Renderer* r, String* dest, SDL_Surface* s,
+                   CellGrid* grid, const CellGrid* prev) {
+    return sample_frame(r, s, grid) && encode_grid(r, dest, grid, prev);
+}
+
+// Source of animation frames. GIFs are decoded one frame at a time, other
+// formats are loaded whole by SDL_image.
+typedef struct Decoder {
+    GifDecoder* gif;
+    IMG_Animation* anim;
+    // Index of the next frame of `anim`
+    uint32_t next;
+    int w;
+    int h;
+} Decoder;
+
+bool Decoder_open(Decoder* d, const char* file) {
+    d->gif = Gif_open(file);
+    if (d->gif != NULL) {
+        d->w = Gif_width(d->gif);
+        d->h = Gif_height(d->gif);
+        if (d->w == 0 || d->h == 0) {
+            SDL_SetError("Empty image");
+            return false;
+        }
+        return true;
+    }
+    d->anim = IMG_LoadAnimation(file);
+    if (d->anim == NULL) {
+        return false;
+    }
+    d->w = d->anim->frames[0]->w;
+    d->h = d->anim->frames[0]->h;
+    return true;
+}
+
+void Decoder_close(Decoder* d) {
+    Gif_close(d->gif);
+    if (d->anim != NULL) {
+        IMG_FreeAnimation(d->anim);
+    }
+}
+
+// A converted frame waiting to be written
+typedef struct FrameSlot {
+    // Decoded frame. Points to `surface` or a frame of the animation.
+    SDL_Surface* image;
+    // Frame time in ms
+    uint32_t delay;
+    // Copy of the GIF canvas, when streaming a GIF
+    SDL_Surface* surface;
+    CellGrid grid;
+    // Downsampled image and its alpha, when frames are converted in parallel
+    uint8_t* pixels;
+    uint8_t* alpha;
+#ifdef _WIN32
+    WString ws;
+#endif
+    String str;
+    // Index of the frame held, valid when `ready` is set
+    uint32_t frame;
+    bool ready;
+} FrameSlot;
+
+// Decode the next frame into `slot`.
+// Returns 1 for a frame, 0 at the end and -1 on error.
+static int Decoder_next(Decoder* d, FrameSlot* slot) {
+    if (d->anim != NULL) {
+        if (d->next == (uint32_t)d->anim->count) {
+            return 0;
+        }
+        slot->image = d->anim->frames[d->next];
+        slot->delay = d->anim->delays[d->next];
+        ++d->next;
+        return 1;
+    }
+    const uint8_t* rgba;
+    int res = Gif_next_frame(d->gif, &rgba, &slot->delay);
+    if (res < 0) {
+        SDL_SetError("Corrupt GIF");
+    }
+    if (res <= 0) {
+        return res;
+    }
+    SDL_Surface* s = slot->surface;
+    for (int y = 0; y < s->h; ++y) {
+        memcpy((uint8_t*)s->pixels + (size_t)y * s->pitch,
+               rgba + (size_t)y * s->w * 4, (size_t)s->w * 4);
+    }
+    slot->image = s;
+    return 1;
+}
+
+// Frames are converted on a background thread while earlier frames are
+// written. Frame `i` is converted into slot `i % slot_count` once the
+// frame that used the slot before has been written.
+typedef struct Player {
+    Renderer conv;
+    Decoder dec;
+    bool delta;
+#ifdef _WIN32
+    bool tty;
+#endif
+    // Convert up to `chunk` frames at once. If more than one frame is
+    // converted each gets a thread, instead of splitting single frames in
+    // bands.
+    bool per_frame;
+    uint32_t chunk;
+    // First frame of the chunk being converted
+    uint32_t chunk_start;
+
+    FrameSlot* slots;
+    uint32_t slot_count;
+
+    SDL_Mutex* lock;
+    SDL_Condition* cond;
+    // Frames [0, played) have been written
+    uint32_t played;
+    // Number of frames, known once the decoder reaches the end
+    uint32_t total;
+    // Quality for the next chunk, set by the writer
+    int scale;
+    uint32_t color_bits;
+    bool quit;
+    bool failed;
+} Player;
+
+static void sample_frame_job(void* arg, uint32_t ix) {
+    Player* p = arg;
+    uint32_t frame = p->chunk_start + ix;
+    FrameSlot* slot = &p->slots[frame % p->slot_count];
+    Renderer conv = p->conv;
+    if (p->per_frame) {
+        conv.pool = NULL;
+        conv.pixels = slot->pixels;
+        conv.alpha = slot->alpha;
+    }
+    // Slots are sized for the smallest scale
+    if (!sample_frame(&conv, slot->image, &slot->grid)) {
+        p->failed = true;
+    }
+}
+
+static void encode_frame_job(void* arg, uint32_t ix) {
+    Player* p = arg;
+    uint32_t frame = p->chunk_start + ix;
+    FrameSlot* slot = &p->slots[frame % p->slot_count];
+    Renderer conv = p->conv;
+    if (p->per_frame) {
+        conv.pool = NULL;
+    }
+    // The first frame is drawn on a cleared screen, so its fully
+    // transparent cells can be skipped even without deltas. Still images
+    // only have that one frame.
+    if (frame == 0) {
+        conv.opts.blank = true;
+    }
+    const CellGrid* prev = NULL;
+    if (p->delta && frame > 0) {
+        prev = &p->slots[(frame - 1) % p->slot_count].grid;
+        // The scale changed, repaint everything
+        if (prev->cols != slot->grid.cols || prev->rows != slot->grid.rows) {
+            prev = NULL;
+        }
+    }
+
+    String_clear(&slot->str);
+    if (!encode_grid(&conv, &slot->str, &slot->grid, prev)) {
+        p->failed = true;
+    }
+#ifdef _WIN32
+    if (p->tty) {
+        WString_clear(&slot->ws);
+        WString_append_utf8_bytes(&slot->ws, slot->str.buffer, slot->str.length);
+    }
+#endif
+    SDL_LockMutex(p->lock);
+    slot->frame = frame;
+    slot->ready = true;
+    SDL_BroadcastCondition(p->cond);
+    SDL_UnlockMutex(p->lock);
+}
+
+static int SDLCALL convert_thread(void* arg) {
+    Player* p = arg;
+    for (uint32_t start = 0;; start += p->chunk) {
+        uint32_t end = start + p->chunk;
+        SDL_LockMutex(p->lock);
+        while (!p->quit && p->played + p->slot_count < end) {
+            SDL_WaitCondition(p->cond, p->lock);
+        }
+        bool quit = p->quit;
+        p->conv.scale = p->scale;
+        p->conv.color_bits = p->color_bits;
+        SDL_UnlockMutex(p->lock);
+        if (quit) {
+            break;
+        }
+
+        // Decoding is sequential, the frames of a chunk are only
+        // converted in parallel
+        uint32_t count = 0;
+        int res = 1;
+        while (count < p->chunk) {
+            res = Decoder_next(&p->dec, &p->slots[(start + count) % p->slot_count]);
+            if (res <= 0) {
+                break;
             }
-            uint32_t rgb1 = r1 | (g1 << 8) | (b1 << 16);
-            uint32_t rgb2 = r2 | (g2 << 8) | (b2 << 16);
-            if (rgb1 == last_rgb1) {
-                if (rgb2 == last_rgb2) {
-                    if (rgb1 == rgb2) {
-                        String_append(dest, ' ');
-                    } else {
-                        String_append_count(dest,  "\xe2\x96\x80", 3);
-                    }
-                } else {
-                    if (rgb1 == rgb2) {
-                        String_format_append(dest, 
-                            "\x1b[48;2;%u;%u;%um ",
-                            (unsigned)r2, (unsigned)g2, (unsigned)b2);
-                    } else {
-                        String_format_append(dest, 
-                            "\x1b[48;2;%u;%u;%um\xe2\x96\x80",
-                            (unsigned)r2, (unsigned)g2, (unsigned)b2);
-                    }
-                }
-            } else if (rgb2 == last_rgb2) {
-                if (rgb1 == rgb2) {
-                    String_format_append(dest, 
-                        "\x1b[38;2;%u;%u;%um ",
-                        (unsigned)r1, (unsigned)g1, (unsigned)b1);
-                } else {
-                    String_format_append(dest, 
-                        "\x1b[38;2;%u;%u;%um\xe2\x96\x80",
-                        (unsigned)r1, (unsigned)g1, (unsigned)b1);
-                }
-            } else if (rgb1 == rgb2) {
-                String_format_append(dest, 
-                    "\x1b[38;2;%u;%u;%um\x1b[48;2;%u;%u;%um ",
-                    (unsigned)r1, (unsigned)g1, (unsigned)b1, 
-                    (unsigned)r2, (unsigned)g2, (unsigned)b2);
+            ++count;
+        }
+        if (res < 0) {
+            p->failed = true;
+        } else if (count > 0) {
+            p->chunk_start = start;
+            p->per_frame = p->conv.pool != NULL && count > 1;
+            if (p->per_frame) {
+                WorkPool_run(p->conv.pool, sample_frame_job, p, count);
+                WorkPool_run(p->conv.pool, encode_frame_job, p, count);
             } else {
-                String_format_append(dest, 
-                    "\x1b[38;2;%u;%u;%um\x1b[48;2;%u;%u;%um\xe2\x96\x80",
-                    (unsigned)r1, (unsigned)g1, (unsigned)b1, 
-                    (unsigned)r2, (unsigned)g2, (unsigned)b2);
+                sample_frame_job(p, 0);
+                encode_frame_job(p, 0);
             }
-            last_rgb1 = rgb1;
-            last_rgb2 = rgb2;
+        }
+        if (p->failed || res == 0) {
+            SDL_LockMutex(p->lock);
+            if (res == 0) {
+                p->total = start + count;
+            }
+            SDL_BroadcastCondition(p->cond);
+            SDL_UnlockMutex(p->lock);
+            break;
+        }
+    }
+    return 0;
+}
+
+// Wait until frame `frame` is converted. Returns NULL after the last frame
+// or on failure, in which case `failed` is set.
+static FrameSlot* Player_wait(Player* p, uint32_t frame, bool* failed) {
+    FrameSlot* slot = &p->slots[frame % p->slot_count];
+    SDL_LockMutex(p->lock);
+    while (!(slot->ready && slot->frame == frame) && !p->failed &&
+           frame < p->total) {
+        SDL_WaitCondition(p->cond, p->lock);
+    }
+    *failed = p->failed;
+    bool ready = slot->ready && slot->frame == frame;
+    SDL_UnlockMutex(p->lock);
+    return ready && !*failed ? slot : NULL;
+}
+
+// Mark frame `frame` as written, freeing its slot
+static void Player_done(Player* p, uint32_t frame) {
+    SDL_LockMutex(p->lock);
+    p->slots[frame % p->slot_count].ready = false;
+    p->played = frame + 1;
+    SDL_BroadcastCondition(p->cond);
+    SDL_UnlockMutex(p->lock);
+}
+
+// Whether frame `frame` is converted
+static bool Player_ready(Player* p, uint32_t frame) {
+    FrameSlot* slot = &p->slots[frame % p->slot_count];
+    SDL_LockMutex(p->lock);
+    bool ready = slot->ready && slot->frame == frame;
+    SDL_UnlockMutex(p->lock);
+    return ready;
+}
+
+static bool quit_requested(void) {
+    SDL_Event e;
+    while (SDL_PollEvent(&e)) {
+        switch (e.type) {
+        case SDL_EVENT_QUIT:
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sleep until the next frame is due. Returns false if asked to quit.
+static bool wait_frame(Pacer* pacer) {
+    // Signals such as Ctrl+C wake the sleep early, so the quit event is
+    // seen right away.
+    while (!Pacer_wait(pacer)) {
+        if (quit_requested()) {
+            return false;
         }
     }
-    String_extend(dest, "\x1b[0m");
+    return !quit_requested();
 }
 
 int main(int argc, char** argv) {
     int status = 0;
-    SDL_Color bg;
-    get_background_color(&bg.r, &bg.g, &bg.b);
+    SDL_Color bg = {0, 0, 0, 0xff};
+    bool bg_known = get_background_color(&bg.r, &bg.g, &bg.b);
     int cw, ch;
     get_console_size(&cw, &ch);
 #ifdef _WIN32
@@ -194,13 +494,63 @@ int main(int argc, char** argv) {
     }
 #endif
     SDL_Init(SDL_INIT_EVENTS);
+    Uint64 start = SDL_GetTicksNS();
+    Uint64 first_byte = 0;
+    Renderer conv = {0};
+    Player player = {0};
+    Pacer pacer = {0};
+    Quality quality;
+    Quality_create(&quality);
+    SDL_Thread* converter = NULL;
+    downsample_init();
     const char* file = filename;
-    if (argc > 1) {
-        file = argv[1];
+    bool delta = false;
+    bool stats = false;
+    bool adapt = true;
+    // REP is not supported by every terminal
+    bool repeat = false;
+    int tolerance = 0;
+    int colors = 0;
+    int jobs = 0;
+    // Memory for frames in flight, in MB
+    int memory = 256;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            printf(usage, argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--delta") == 0) {
+            delta = true;
+        } else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "-f") == 0 ||
+                   strcmp(argv[i], "--fixed-quality") == 0) {
+            adapt = false;
+        } else if (strcmp(argv[i], "--repeat") == 0) {
+            repeat = true;
+        } else if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--tolerance") == 0) &&
+                   i + 1 < argc) {
+            tolerance = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--colors") == 0) &&
+                   i + 1 < argc) {
+            colors = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) &&
+                   i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--memory") == 0) &&
+                   i + 1 < argc) {
+            memory = atoi(argv[++i]);
+        } else {
+            file = argv[i];
+        }
+    }
+
+    WorkPool* pool = NULL;
+    if (jobs != 1) {
+        pool = WorkPool_create(jobs < 0 ? 0 : jobs);
     }
 
-    IMG_Animation* a = IMG_LoadAnimation(file);
-    if (a == NULL) {
+    Decoder* dec = &player.dec;
+    if (!Decoder_open(dec, file)) {
         fprintf(stderr, "Failed converting %s: %s\n", file, SDL_GetError());
         status = 1;
         goto end;
@@ -209,68 +559,192 @@ int main(int argc, char** argv) {
     ch = ch * 2; // Two pixels per row
 
     int scale = 1;
-    int pw = a->frames[0]->w;
-    int ph = a->frames[0]->h;
+    int pw = dec->w;
+    int ph = dec->h;
 
     while (pw > cw || ph > ch) {
         ++scale;
-        pw = (a->frames[0]->w + scale - 1) / scale;
-        ph = (a->frames[0]->h + scale - 1) / scale;
+        pw = (dec->w + scale - 1) / scale;
+        ph = (dec->h + scale - 1) / scale;
     }
 
-    String* str;
-#ifdef _WIN32
-    WString* ws;
-    if (tty) {
-        ws = SDL_malloc(a->count * sizeof(WString));
-    } else {
-        str = SDL_malloc(a->count * sizeof(String));
+    if (!Renderer_create(&conv, pw, ph, pool)) {
+        fprintf(stderr, "Out of memory\n");
+        status = 1;
+        goto end;
     }
-#else
-    str = SDL_malloc(a->count * sizeof(String));
-#endif
-    for (uint32_t i = 0; i < a->count; ++i) {
-        String dest;
-        String_create(&dest);
-        String_format_append(&dest, "\x1b[1;1H");
-        convert_frame(&dest, a->frames[i], scale, bg);
+    conv.scale = scale;
+    conv.opts.tolerance = tolerance > 0 ? tolerance : 0;
+    conv.opts.repeat = repeat;
+    if (colors == 256 || colors == 16) {
+        palette_init();
+        conv.opts.colors = colors == 256 ? ENCODE_256 : ENCODE_16;
+    }
+    conv.bg[0] = bg.r;
+    conv.bg[1] = bg.g;
+    conv.bg[2] = bg.b;
+    // Transparent pixels blend into the background, which "\x1b[49m" can
+    // then set
+    conv.opts.has_default_bg = bg_known;
+    conv.opts.default_bg = CELL_RGB(bg.r, bg.g, bg.b);
+    // Over a screen that was cleared fully transparent cells can be skipped.
+    // Full frames after the first are drawn over the one before unless
+    // playing deltas.
+    conv.opts.blank = delta;
+
+    player.conv = conv;
+    player.delta = delta;
 #ifdef _WIN32
-        if (tty) {
-            WString_create(&ws[i]);
-            WString_from_utf8_bytes(&ws[i], dest.buffer, dest.length);
-            String_free(&dest);
-        } else {
-            str[i] = dest;
+    player.tty = tty;
+#endif
+    player.total = UINT32_MAX;
+    player.scale = conv.scale;
+    player.color_bits = conv.color_bits;
+    player.chunk = 1;
+    if (conv.pool != NULL) {
+        // Frames in flight are bounded by the memory budget, since the
+        // number of frames is not known until the decoder reaches the end.
+        uint64_t cells = (uint64_t)pw * ((ph + 1) / 2);
+        uint64_t slot_size = (uint64_t)pw * ph * sizeof(SDL_Color) +
+                             cells * (sizeof(Cell) + ANSI_CELL_MAX);
+        if (dec->gif != NULL) {
+            slot_size += (uint64_t)dec->w * dec->h * 4;
         }
-#else
-        str[i] = dest;
+        uint64_t slots = (uint64_t)(memory > 0 ? memory : 0) * 1024 * 1024 /
+                         slot_size;
+        uint64_t fit = slots > 1 ? (slots - 1) / 2 : 0;
+        player.chunk = WorkPool_size(conv.pool);
+        if (fit < player.chunk) {
+            player.chunk = fit > 0 ? (uint32_t)fit : 1;
+        }
+    }
+    // Delta frames need the grid of the frame before the chunk, so one
+    // chunk of slots is not enough. The extra slot lets the frame after
+    // next be converted while a frame is written, so a late frame can be
+    // skipped without waiting.
+    player.slot_count = 2 * player.chunk + 1;
+    player.slots = SDL_calloc(player.slot_count, sizeof(FrameSlot));
+    player.lock = SDL_CreateMutex();
+    player.cond = SDL_CreateCondition();
+    if (player.slots == NULL || player.lock == NULL || player.cond == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        status = 1;
+        goto end;
+    }
+    for (uint32_t i = 0; i < player.slot_count; ++i) {
+        FrameSlot* slot = &player.slots[i];
+        if (!CellGrid_create(&slot->grid, pw, (ph + 1) / 2) ||
+            !String_create(&slot->str)) {
+            fprintf(stderr, "Out of memory\n");
+            status = 1;
+            goto end;
+        }
+#ifdef _WIN32
+        WString_create(&slot->ws);
 #endif
+        if (player.chunk > 1) {
+            slot->pixels = SDL_malloc(pw * ph * 4);
+            slot->alpha = SDL_malloc(pw * ph);
+            if (slot->pixels == NULL || slot->alpha == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                status = 1;
+                goto end;
+            }
+        }
+        if (dec->gif != NULL) {
+            slot->surface = SDL_CreateSurface(dec->w, dec->h, SDL_PIXELFORMAT_RGBA32);
+            if (slot->surface == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                status = 1;
+                goto end;
+            }
+        }
+    }
+
+    if (!Pacer_create(&pacer)) {
+        fprintf(stderr, "Failed creating timer\n");
+        status = 1;
+        goto end;
     }
 
-    for (uint32_t i = 0; i < a->count; ++i) {
+    converter = SDL_CreateThread(convert_thread, "convert", &player);
+    if (converter == NULL) {
+        fprintf(stderr, "Failed creating thread: %s\n", SDL_GetError());
+        status = 1;
+        goto end;
+    }
+
+    // Size of the frame on screen
+    uint32_t shown_cols = 0;
+    uint32_t shown_rows = 0;
+    for (uint32_t i = 0;; ++i) {
+        bool failed;
+        FrameSlot* slot = Player_wait(&player, i, &failed);
+        if (failed) {
+            fprintf(stderr, "Failed converting %s: %s\n", file, SDL_GetError());
+            status = 1;
+            goto end;
+        }
+        if (slot == NULL) {
+            break;
+        }
+        uint32_t delay = slot->delay;
+        if (!wait_frame(&pacer)) {
+            goto end;
+        }
+        // Delta frames only paint what changed since the frame before, so
+        // only full frames can be skipped. The frame after must already be
+        // converted, which also keeps the last frame from being skipped.
+        if (!delta && Pacer_behind(&pacer, delay) && Player_ready(&player, i + 1)) {
+            Pacer_drop(&pacer, delay);
+            Player_done(&player, i);
+            continue;
+        }
+        Pacer_show(&pacer, delay);
+        Uint64 write_start = SDL_GetTicksNS();
+        // The first frame starts on a clear screen, where transparent cells
+        // are left unpainted. Later, clear what a frame at the previous
+        // scale left around this one.
+        bool clear = i == 0 || slot->grid.cols != shown_cols ||
+                     slot->grid.rows != shown_rows;
+        shown_cols = slot->grid.cols;
+        shown_rows = slot->grid.rows;
 #ifdef _WIN32
         if (tty) {
-            WriteConsoleW(out, ws[i % a->count].buffer, ws[i % a->count].length, NULL, NULL);
+            if (clear) {
+                WriteConsoleW(out, L"\x1b[2J", 4, NULL, NULL);
+            }
+            WriteConsoleW(out, slot->ws.buffer, slot->ws.length, NULL, NULL);
         } else {
             DWORD w;
-            WriteFile(out, str[i].buffer, str[i].length, &w, NULL);
+            if (clear) {
+                WriteFile(out, "\x1b[2J", 4, &w, NULL);
+            }
+            WriteFile(out, slot->str.buffer, slot->str.length, &w, NULL);
         }
 #else
-        fwrite(str[i % a->count].buffer, 1, str[i % a->count].length, stdout);
+        if (clear) {
+            fwrite("\x1b[2J", 1, 4, stdout);
+        }
+        fwrite(slot->str.buffer, 1, slot->str.length, stdout);
+        fflush(stdout);
 #endif
-        Uint64 now = SDL_GetTicks();
-        int delay = a->delays[i % a->count];
-        while (SDL_GetTicks() - now < delay) {
-            SDL_Event e;
-            while (SDL_PollEvent(&e)) {
-                switch (e.type) {
-                case SDL_EVENT_QUIT:
-                    goto end;
-                }
-            }
-            SDL_Delay(1);
+        Uint64 write_end = SDL_GetTicksNS();
+        if (i == 0) {
+            first_byte = write_end - start;
         }
+        if (adapt && Quality_update(&quality, slot->str.length,
+                                    write_end - write_start,
+                                    (uint64_t)delay * 1000000)) {
+            SDL_LockMutex(player.lock);
+            player.scale = conv.scale + Quality_scale(&quality);
+            player.color_bits = Quality_color_bits(&quality);
+            SDL_UnlockMutex(player.lock);
+        }
+        Player_done(&player, i);
     }
+    // Keep the last frame up for its delay
+    wait_frame(&pacer);
 end:
 #ifdef _WIN32
     if (tty) {
@@ -283,6 +757,27 @@ end:
 #else
     fwrite("\n", 1, 1, stdout);
 #endif
+    if (converter != NULL) {
+        SDL_LockMutex(player.lock);
+        player.quit = true;
+        SDL_BroadcastCondition(player.cond);
+        SDL_UnlockMutex(player.lock);
+        SDL_WaitThread(converter, NULL);
+    }
+    Decoder_close(&player.dec);
+    Renderer_free(&conv);
+    WorkPool_free(pool);
+    Pacer_free(&pacer);
+    if (stats && first_byte > 0) {
+        fprintf(stderr, "First frame written after %.2f ms\n", first_byte / 1e6);
+    }
+    if (stats && pacer.shown > 0) {
+        fprintf(stderr, "%llu frames shown, %llu dropped\n",
+                (unsigned long long)pacer.shown, (unsigned long long)pacer.dropped);
+        fprintf(stderr, "Frames late by %.2f ms on average, %.2f ms at most\n",
+                pacer.late_total / 1e6 / pacer.shown, pacer.late_max / 1e6);
+        fprintf(stderr, "Ended at quality level %u\n", quality.level);
+    }
     SDL_Quit();
     return status;
 }
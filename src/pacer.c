@@ -0,0 +1,124 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include "pacer.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+// Longest single wait, so a quit request is noticed without signals
+#define MAX_WAIT_NS 100000000ull
+#else
+#include <errno.h>
+#include <time.h>
+#endif
+
+uint64_t Pacer_now(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    LARGE_INTEGER c;
+    QueryPerformanceCounter(&c);
+    uint64_t f = freq.QuadPart;
+    uint64_t t = c.QuadPart;
+    return (t / f) * 1000000000ull + (t % f) * 1000000000ull / f;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+bool Pacer_create(Pacer_noinit* p) {
+    p->deadline = Pacer_now();
+    p->shown = 0;
+    p->dropped = 0;
+    p->late_total = 0;
+    p->late_max = 0;
+#ifdef _WIN32
+    // High resolution timers need Windows 10 1803, fall back to the
+    // regular timer before that.
+    p->timer = CreateWaitableTimerExW(NULL, NULL,
+                                      CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                      TIMER_ALL_ACCESS);
+    if (p->timer == NULL) {
+        p->timer = CreateWaitableTimerW(NULL, TRUE, NULL);
+        if (p->timer == NULL) {
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+void Pacer_free(Pacer* p) {
+#ifdef _WIN32
+    if (p->timer != NULL) {
+        CloseHandle(p->timer);
+    }
+#else
+    (void)p;
+#endif
+}
+
+bool Pacer_wait(Pacer* p) {
+#ifdef _WIN32
+    uint64_t now = Pacer_now();
+    if (now >= p->deadline) {
+        return true;
+    }
+    uint64_t left = p->deadline - now;
+    bool last = left <= MAX_WAIT_NS;
+    if (!last) {
+        left = MAX_WAIT_NS;
+    }
+    // Relative due time in 100 ns units
+    LARGE_INTEGER due;
+    due.QuadPart = -(LONGLONG)(left / 100);
+    if (!SetWaitableTimer(p->timer, &due, 0, NULL, NULL, FALSE)) {
+        Sleep((DWORD)(left / 1000000));
+    } else {
+        WaitForSingleObject(p->timer, INFINITE);
+    }
+    return last && Pacer_now() >= p->deadline;
+#else
+    struct timespec ts;
+    ts.tv_sec = p->deadline / 1000000000ull;
+    ts.tv_nsec = p->deadline % 1000000000ull;
+    // Absolute sleeps do not drift when restarted after an interruption
+    return clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != EINTR;
+#endif
+}
+
+bool Pacer_behind(const Pacer* p, uint32_t delay) {
+    if (p->shown == 0) {
+        return false;
+    }
+    return Pacer_now() >= p->deadline + (uint64_t)delay * 1000000;
+}
+
+void Pacer_show(Pacer* p, uint32_t delay) {
+    uint64_t now = Pacer_now();
+    uint64_t late = now > p->deadline ? now - p->deadline : 0;
+    // The first frame starts the schedule, it is never late
+    if (p->shown == 0) {
+        p->deadline = now;
+        late = 0;
+    }
+    ++p->shown;
+    p->late_total += late;
+    if (late > p->late_max) {
+        p->late_max = late;
+    }
+    p->deadline += (uint64_t)delay * 1000000;
+}
+
+void Pacer_drop(Pacer* p, uint32_t delay) {
+    ++p->dropped;
+    p->deadline += (uint64_t)delay * 1000000;
+}
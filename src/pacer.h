@@ -0,0 +1,56 @@
+#ifndef PACER_H_00
+#define PACER_H_00
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Schedules frames at absolute deadlines, so the time spent writing a
+// frame does not push back the frames after it.
+typedef struct Pacer {
+    // Time the next frame is due, in ns
+    uint64_t deadline;
+    uint64_t shown;
+    uint64_t dropped;
+    // How late shown frames were, in ns
+    uint64_t late_total;
+    uint64_t late_max;
+#ifdef _WIN32
+    void* timer;
+#endif
+} Pacer;
+
+typedef Pacer Pacer_noinit;
+
+// Monotonic time in ns
+uint64_t Pacer_now(void);
+
+// Create a pacer with the first frame due now
+bool Pacer_create(Pacer_noinit* p);
+
+// Free a pacer
+void Pacer_free(Pacer* p);
+
+// Sleep until the next frame is due. Returns false if woken early, for
+// example by a signal, in which case it should be called again.
+bool Pacer_wait(Pacer* p);
+
+// Whether the next frame is so late that the one after it, shown for
+// `delay` ms, is already due. Never true for the first frame, which starts
+// the schedule.
+bool Pacer_behind(const Pacer* p, uint32_t delay);
+
+// Record that the next frame is shown now, for `delay` ms
+void Pacer_show(Pacer* p, uint32_t delay);
+
+// Record that the next frame was skipped. It would have been shown for
+// `delay` ms.
+void Pacer_drop(Pacer* p, uint32_t delay);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,81 @@
+#include <math.h>
+
+#include "palette.h"
+
+const uint8_t palette_rgb[256][3] = {
+    {0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0},
+    {0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+    {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0},
+    {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255},
+#define L(x) ((x) == 0 ? 0 : 55 + 40 * (x))
+#define CUBE_B(r, g) \
+    {L(r), L(g), L(0)}, {L(r), L(g), L(1)}, {L(r), L(g), L(2)}, \
+    {L(r), L(g), L(3)}, {L(r), L(g), L(4)}, {L(r), L(g), L(5)}
+#define CUBE_G(r) \
+    CUBE_B(r, 0), CUBE_B(r, 1), CUBE_B(r, 2), \
+    CUBE_B(r, 3), CUBE_B(r, 4), CUBE_B(r, 5)
+    CUBE_G(0), CUBE_G(1), CUBE_G(2), CUBE_G(3), CUBE_G(4), CUBE_G(5),
+#undef CUBE_G
+#undef CUBE_B
+#undef L
+#define GRAY(i) {8 + 10 * (i), 8 + 10 * (i), 8 + 10 * (i)}
+    GRAY(0), GRAY(1), GRAY(2), GRAY(3), GRAY(4), GRAY(5),
+    GRAY(6), GRAY(7), GRAY(8), GRAY(9), GRAY(10), GRAY(11),
+    GRAY(12), GRAY(13), GRAY(14), GRAY(15), GRAY(16), GRAY(17),
+    GRAY(18), GRAY(19), GRAY(20), GRAY(21), GRAY(22), GRAY(23)
+#undef GRAY
+};
+
+uint8_t palette_lut_256[32 * 32 * 32];
+uint8_t palette_lut_16[32 * 32 * 32];
+
+static float linear(uint8_t c) {
+    float v = c / 255.0f;
+    return v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+}
+
+static void to_oklab(uint8_t r8, uint8_t g8, uint8_t b8, float lab[3]) {
+    float r = linear(r8), g = linear(g8), b = linear(b8);
+    float l = cbrtf(0.4122214708f * r + 0.5363325363f * g + 0.0514459929f * b);
+    float m = cbrtf(0.2119034982f * r + 0.6806995451f * g + 0.1073969566f * b);
+    float s = cbrtf(0.0883024619f * r + 0.2817188376f * g + 0.6299787005f * b);
+    lab[0] = 0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s;
+    lab[1] = 1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s;
+    lab[2] = 0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s;
+}
+
+static uint8_t nearest(const float lab[3], float pal[256][3], uint32_t first,
+                       uint32_t end) {
+    uint8_t best = first;
+    float best_d = INFINITY;
+    for (uint32_t i = first; i < end; ++i) {
+        float d0 = lab[0] - pal[i][0];
+        float d1 = lab[1] - pal[i][1];
+        float d2 = lab[2] - pal[i][2];
+        float d = d0 * d0 + d1 * d1 + d2 * d2;
+        if (d < best_d) {
+            best_d = d;
+            best = i;
+        }
+    }
+    return best;
+}
+
+void palette_init(void) {
+    float pal[256][3];
+    for (uint32_t i = 0; i < 256; ++i) {
+        to_oklab(palette_rgb[i][0], palette_rgb[i][1], palette_rgb[i][2], pal[i]);
+    }
+    for (uint32_t b = 0; b < 32; ++b) {
+        for (uint32_t g = 0; g < 32; ++g) {
+            for (uint32_t r = 0; r < 32; ++r) {
+                // Match the middle of the range of colors sharing the entry
+                float lab[3];
+                to_oklab(8 * r + 4, 8 * g + 4, 8 * b + 4, lab);
+                uint32_t ix = r | (g << 5) | (b << 10);
+                palette_lut_256[ix] = nearest(lab, pal, 16, 256);
+                palette_lut_16[ix] = nearest(lab, pal, 0, 16);
+            }
+        }
+    }
+}
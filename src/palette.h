@@ -0,0 +1,54 @@
+#ifndef PALETTE_H_00
+#define PALETTE_H_00
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Colors of the xterm 256 color palette. Entries 0-15 are the xterm
+// defaults of the basic colors, which terminals often change.
+extern const uint8_t palette_rgb[256][3];
+
+// Nearest palette entry for every color, indexed by palette_lut_index.
+// palette_lut_256 only holds entries 16-255, palette_lut_16 entries 0-15.
+extern uint8_t palette_lut_256[32 * 32 * 32];
+extern uint8_t palette_lut_16[32 * 32 * 32];
+
+// Fill the lookup tables, matching colors in the Oklab color space.
+// Call once at startup before using them.
+void palette_init(void);
+
+// Whether `v` is one of the levels of the color cube, 0 and 95 + 40n
+static inline bool palette_cube_level(uint8_t v) {
+    static const uint64_t levels[4] = {
+        0x1, 0x80000000, 0x0000800000000080, 0x8000000000800000
+    };
+    return (levels[v >> 6] >> (v & 63)) & 1;
+}
+
+// Entry 16-255 of the palette that is exactly the color r, g, b, or -1.
+// Does not need palette_init.
+static inline int32_t palette_exact(uint8_t r, uint8_t g, uint8_t b) {
+    if (palette_cube_level(r) && palette_cube_level(g) && palette_cube_level(b)) {
+        return 16 + 36 * (r == 0 ? 0 : (r - 55) / 40) +
+               6 * (g == 0 ? 0 : (g - 55) / 40) + (b == 0 ? 0 : (b - 55) / 40);
+    }
+    // Grays are 8 + 10n up to 238
+    if (r == g && g == b && r >= 8 && r <= 238 && (r - 8) % 10 == 0) {
+        return 232 + (r - 8) / 10;
+    }
+    return -1;
+}
+
+// Index into the lookup tables, from the top 5 bits of each channel
+static inline uint32_t palette_lut_index(uint8_t r, uint8_t g, uint8_t b) {
+    return (r >> 3) | ((uint32_t)(g >> 3) << 5) | ((uint32_t)(b >> 3) << 10);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
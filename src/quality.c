@@ -0,0 +1,95 @@
+#include "quality.h"
+
+// Fewer color bits make neighbouring cells share colors, so fewer color
+// changes are written. Past that the image is scaled down further.
+static const struct {
+    uint8_t scale;
+    uint8_t bits;
+} levels[QUALITY_LEVELS] = {
+    {0, 8}, {0, 6}, {0, 5}, {1, 5}, {1, 4}, {2, 4}, {3, 4}, {4, 4}
+};
+
+// Lower the quality when writes take this much of the frame time...
+#define LOAD_HIGH 0.9
+#define OVER_FRAMES 3
+// ...and raise it when the level above is expected to take less than this
+#define LOAD_LOW 0.6
+#define UNDER_FRAMES 30
+// Frames after a change before the load reflects the new level
+#define HOLD_FRAMES 5
+// Weight of the newest frame in smoothed values
+#define SMOOTH 0.25
+
+static void smooth(double* v, double x) {
+    *v = *v == 0.0 ? x : *v + SMOOTH * (x - *v);
+}
+
+void Quality_create(Quality_noinit* q) {
+    q->level = 0;
+    q->load = 0.0;
+    q->write_bytes = 0.0;
+    q->write_ns = 0.0;
+    for (uint32_t i = 0; i < QUALITY_LEVELS; ++i) {
+        q->level_bytes[i] = 0.0;
+    }
+    q->over = 0;
+    q->under = 0;
+    q->hold = 0;
+}
+
+static void set_level(Quality* q, uint32_t level) {
+    q->level = level;
+    q->over = 0;
+    q->under = 0;
+    q->hold = HOLD_FRAMES;
+    q->load = 0.0;
+}
+
+bool Quality_update(Quality* q, uint64_t bytes, uint64_t write_ns,
+                    uint64_t frame_ns) {
+    if (frame_ns == 0) {
+        return false;
+    }
+    smooth(&q->load, (double)write_ns / frame_ns);
+    smooth(&q->write_bytes, (double)bytes);
+    smooth(&q->write_ns, (double)write_ns);
+    smooth(&q->level_bytes[q->level], (double)bytes);
+    if (q->hold > 0) {
+        --q->hold;
+        return false;
+    }
+
+    if (q->load > LOAD_HIGH) {
+        q->under = 0;
+        if (++q->over >= OVER_FRAMES && q->level + 1 < QUALITY_LEVELS) {
+            set_level(q, q->level + 1);
+            return true;
+        }
+        return false;
+    }
+    q->over = 0;
+    if (q->level == 0 || q->write_bytes == 0.0) {
+        return false;
+    }
+    // Estimate the load one level up from the bytes it took last time
+    // and the current rate of the output
+    double ns_per_byte = q->write_ns / q->write_bytes;
+    double load = q->level_bytes[q->level - 1] * ns_per_byte / frame_ns;
+    if (load < LOAD_LOW) {
+        if (++q->under >= UNDER_FRAMES) {
+            set_level(q, q->level - 1);
+            return true;
+        }
+    } else {
+        q->under = 0;
+    }
+    return false;
+}
+
+uint32_t Quality_scale(const Quality* q) {
+    return levels[q->level].scale;
+}
+
+uint32_t Quality_color_bits(const Quality* q) {
+    return levels[q->level].bits;
+}
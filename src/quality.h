@@ -0,0 +1,51 @@
+#ifndef QUALITY_H_00
+#define QUALITY_H_00
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define QUALITY_LEVELS 8
+
+// Lowers the image quality when frames are written slower than they are
+// shown, and raises it again once there is room. Level 0 is full quality,
+// every level above it writes fewer bytes per frame.
+typedef struct Quality {
+    uint32_t level;
+    // Smoothed ratio of write time to frame time
+    double load;
+    // Smoothed bytes and time per write, giving the rate of the output
+    double write_bytes;
+    double write_ns;
+    // Smoothed bytes per frame at each level, 0 if not seen yet
+    double level_bytes[QUALITY_LEVELS];
+    // Frames in a row above or below the thresholds
+    uint32_t over;
+    uint32_t under;
+    // Frames to wait after a change before the next one
+    uint32_t hold;
+} Quality;
+
+typedef Quality Quality_noinit;
+
+// Start at full quality
+void Quality_create(Quality_noinit* q);
+
+// Record that a frame of `bytes` took `write_ns` to write, with frames
+// shown every `frame_ns`. Returns true if the level changed.
+bool Quality_update(Quality* q, uint64_t bytes, uint64_t write_ns,
+                    uint64_t frame_ns);
+
+// Amount added to the downscale factor at the current level
+uint32_t Quality_scale(const Quality* q);
+
+// Bits kept of each color channel at the current level
+uint32_t Quality_color_bits(const Quality* q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
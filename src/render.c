@@ -0,0 +1,520 @@
+#include <string.h>
+
+#include "render.h"
+#include "mem.h"
+
+// Bytes per pixel and offsets of red, green, blue and alpha for each
+// RENDER_ layout. YUV has its own kernels, which only use the size of the
+// Y samples.
+static const uint8_t formats[RENDER_FORMATS][5] = {
+    {4, 0, 1, 2, 3},
+    {4, 2, 1, 0, 3},
+    {4, 1, 2, 3, 0},
+    {4, 3, 2, 1, 0},
+    {4, 0, 1, 2, DOWNSAMPLE_NO_ALPHA},
+    {4, 2, 1, 0, DOWNSAMPLE_NO_ALPHA},
+    {4, 1, 2, 3, DOWNSAMPLE_NO_ALPHA},
+    {4, 3, 2, 1, DOWNSAMPLE_NO_ALPHA},
+    {3, 0, 1, 2, DOWNSAMPLE_NO_ALPHA},
+    {3, 2, 1, 0, DOWNSAMPLE_NO_ALPHA},
+    {1, 0, 0, 0, DOWNSAMPLE_NO_ALPHA},
+    {1, 0, 0, 0, DOWNSAMPLE_NO_ALPHA},
+    {2, 0, 0, 0, DOWNSAMPLE_NO_ALPHA},
+};
+
+RenderImage RenderImage_from(const void* pixels, uint32_t w, uint32_t h,
+                             uint32_t pitch, uint32_t format) {
+    RenderImage img;
+    img.pixels = pixels;
+    img.w = w;
+    img.h = h;
+    img.pitch = pitch;
+    img.bpp = formats[format][0];
+    memcpy(img.order, formats[format] + 1, 4);
+    img.format = format;
+    img.chroma[0] = NULL;
+    img.chroma[1] = NULL;
+    img.chroma_pitch = 0;
+    if (format == RENDER_I420) {
+        img.chroma_pitch = (pitch + 1) / 2;
+        img.chroma[0] = img.pixels + (size_t)pitch * h;
+        img.chroma[1] = img.chroma[0] + (size_t)img.chroma_pitch * ((h + 1) / 2);
+    } else if (format == RENDER_NV12) {
+        img.chroma_pitch = pitch;
+        img.chroma[0] = img.pixels + (size_t)pitch * h;
+        img.chroma[1] = img.chroma[0];
+    }
+    return img;
+}
+
+bool Renderer_create(Renderer_noinit* r, uint32_t cols, uint32_t pixel_rows,
+                     WorkPool* pool) {
+    memset(r, 0, sizeof(Renderer));
+    r->scale = 1;
+    r->color_bits = 8;
+    r->pool = pool;
+    r->pixels = Mem_alloc((size_t)cols * pixel_rows * 4);
+    r->alpha = Mem_alloc((size_t)cols * pixel_rows);
+    if (r->pixels == NULL || r->alpha == NULL) {
+        Renderer_free(r);
+        return false;
+    }
+    if (pool != NULL) {
+        // More bands than threads evens out rows that take longer
+        r->band_count = WorkPool_size(pool) * 4;
+        r->bands = Mem_alloc(r->band_count * sizeof(String));
+        if (r->bands == NULL) {
+            r->band_count = 0;
+            Renderer_free(r);
+            return false;
+        }
+        for (uint32_t i = 0; i < r->band_count; ++i) {
+            String_create(&r->bands[i]);
+        }
+    }
+    return true;
+}
+
+void Renderer_free(Renderer* r) {
+    for (uint32_t i = 0; i < r->band_count; ++i) {
+        String_free(&r->bands[i]);
+    }
+    if (r->bands != NULL) {
+        Mem_free(r->bands);
+    }
+    if (r->pixels != NULL) {
+        Mem_free(r->pixels);
+    }
+    if (r->alpha != NULL) {
+        Mem_free(r->alpha);
+    }
+    r->bands = NULL;
+    r->band_count = 0;
+    r->pixels = NULL;
+    r->alpha = NULL;
+}
+
+// Each kernel below only gets its own constants if the shared body is
+// inlined into it
+#ifdef _MSC_VER
+#define KERNEL_INLINE static __forceinline
+#else
+#define KERNEL_INLINE static inline __attribute__((always_inline))
+#endif
+
+// Average of `sum`, taken over `rows` rows of a block `scale` pixels wide.
+// Full blocks divide by a constant in kernels for a fixed scale.
+static inline uint8_t block_average(uint32_t sum, uint32_t rows, uint32_t scale) {
+    return rows == scale ? sum / (scale * scale) : sum / (scale * rows);
+}
+
+// Store a pixel of the downsampled image, at `out` in the RGBA image or,
+// when `direct`, as the `half` of `cell`
+static inline void store_pixel(uint8_t* out, Cell* cell, uint32_t half,
+                               uint32_t r, uint32_t g, uint32_t b, uint32_t a,
+                               bool direct) {
+    if (direct) {
+        if (half) {
+            cell->bottom = CELL_RGB(r, g, b);
+        } else {
+            cell->top = CELL_RGB(r, g, b);
+        }
+    } else {
+        out[0] = r;
+        out[1] = g;
+        out[2] = b;
+        out[3] = a;
+    }
+}
+
+// Downsample the output rows [y0, y1) of `img` into the RGBA image `dest`.
+// The layout and `fixed_scale` are constants in each instantiation below,
+// so every common case compiles to its own kernel. A `fixed_scale` of 0
+// uses `scale`. Sets `opaque` if every output pixel has an alpha of 0xff.
+// Layouts without alpha have nothing to blend, so their kernels skip
+// `dest` and store straight into the cells of `grid`.
+KERNEL_INLINE bool sample_kernel(const RenderImage* img, uint32_t scale,
+                                uint8_t* dest, CellGrid* grid, uint32_t y0,
+                                uint32_t y1, bool* opaque, uint32_t bpp,
+                                uint32_t ri, uint32_t gi, uint32_t bi,
+                                uint32_t ai, uint32_t fixed_scale) {
+    if (fixed_scale != 0) {
+        scale = fixed_scale;
+    }
+    bool direct = ai == DOWNSAMPLE_NO_ALPHA;
+    uint32_t w = img->w;
+    uint32_t h = img->h;
+    uint32_t pw = (w + scale - 1) / scale;
+    uint32_t all = 0xff;
+    if (direct && (y1 & 1) != 0) {
+        // The last cell row has no bottom pixels
+        Cell* row = grid->cells + (y1 / 2) * grid->cols;
+        for (uint32_t x = 0; x < pw; ++x) {
+            row[x].bottom = 0;
+        }
+    }
+    if (scale == 1) {
+        // Nothing to average, copy the channels
+        for (uint32_t y = y0; y < y1; ++y) {
+            const uint8_t* px = img->pixels + (size_t)y * img->pitch;
+            uint8_t* out = dest + (size_t)y * pw * 4;
+            Cell* cell = grid->cells + (y / 2) * grid->cols;
+            for (uint32_t x = 0; x < w; ++x, px += bpp, out += 4, ++cell) {
+                uint32_t a = ai != DOWNSAMPLE_NO_ALPHA ? px[ai] : 0xff;
+                store_pixel(out, cell, y & 1, px[ri], px[gi], px[bi], a, direct);
+                all &= a;
+            }
+        }
+        *opaque = all == 0xff;
+        return true;
+    }
+
+    uint32_t* sums = Mem_alloc(w * bpp * sizeof(uint32_t));
+    if (sums == NULL) {
+        return false;
+    }
+    // Blocks in the last column may be narrower
+    uint32_t full = w / scale;
+    for (uint32_t oy = y0; oy < y1; ++oy) {
+        uint32_t sy0 = oy * scale;
+        uint32_t sy1 = sy0 + scale < h ? sy0 + scale : h;
+        uint32_t rows = sy1 - sy0;
+        memset(sums, 0, w * bpp * sizeof(uint32_t));
+        for (uint32_t y = sy0; y < sy1; ++y) {
+            accumulate_row(sums, img->pixels + (size_t)y * img->pitch, w * bpp);
+        }
+        uint8_t* out = dest + (size_t)oy * pw * 4;
+        Cell* cell = grid->cells + (oy / 2) * grid->cols;
+        uint32_t half = oy & 1;
+        const uint32_t* px = sums;
+        for (uint32_t ox = 0; ox < full; ++ox, out += 4, ++cell) {
+            uint32_t r = 0, g = 0, b = 0, a = 0;
+            for (uint32_t i = 0; i < scale; ++i, px += bpp) {
+                r += px[ri];
+                g += px[gi];
+                b += px[bi];
+                if (ai != DOWNSAMPLE_NO_ALPHA) {
+                    a += px[ai];
+                }
+            }
+            a = ai != DOWNSAMPLE_NO_ALPHA ? block_average(a, rows, scale) : 0xff;
+            store_pixel(out, cell, half, block_average(r, rows, scale),
+                        block_average(g, rows, scale),
+                        block_average(b, rows, scale), a, direct);
+            all &= a;
+        }
+        if (full < pw) {
+            uint32_t n = w - full * scale;
+            uint32_t r = 0, g = 0, b = 0, a = 0;
+            for (uint32_t i = 0; i < n; ++i, px += bpp) {
+                r += px[ri];
+                g += px[gi];
+                b += px[bi];
+                if (ai != DOWNSAMPLE_NO_ALPHA) {
+                    a += px[ai];
+                }
+            }
+            uint32_t count = n * rows;
+            a = ai != DOWNSAMPLE_NO_ALPHA ? a / count : 0xff;
+            store_pixel(out, cell, half, r / count, g / count, b / count, a,
+                        direct);
+            all &= a;
+        }
+    }
+    Mem_free(sums);
+    *opaque = all == 0xff;
+    return true;
+}
+
+static inline uint8_t clamp_u8(int32_t v) {
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// Store the BT.601 limited range color `y`, `u`, `v` as the `half` of `cell`
+static inline void store_yuv(Cell* cell, uint32_t half, uint32_t y,
+                             uint32_t u, uint32_t v) {
+    int32_t c = 298 * ((int32_t)y - 16) + 128;
+    int32_t d = (int32_t)u - 128;
+    int32_t e = (int32_t)v - 128;
+    store_pixel(NULL, cell, half, clamp_u8((c + 409 * e) >> 8),
+                clamp_u8((c - 100 * d - 208 * e) >> 8),
+                clamp_u8((c + 516 * d) >> 8), 0xff, true);
+}
+
+// Downsample the output rows [y0, y1) of the YUV image `img` straight into
+// the cells of `grid`. Y is averaged over each block and U and V over the
+// chroma samples that cover it, so colors are converted once per half
+// cell instead of once per pixel. Instantiated like sample_kernel.
+KERNEL_INLINE bool yuv_kernel(const RenderImage* img, uint32_t scale,
+                             CellGrid* grid, uint32_t y0, uint32_t y1,
+                             uint32_t format, uint32_t fixed_scale) {
+    if (fixed_scale != 0) {
+        scale = fixed_scale;
+    }
+    bool packed = format == RENDER_YUY2;
+    uint32_t w = img->w;
+    uint32_t h = img->h;
+    uint32_t pw = (w + scale - 1) / scale;
+    // Pixels come in pairs that share chroma
+    uint32_t cw = (w + 1) / 2;
+    if ((y1 & 1) != 0) {
+        Cell* row = grid->cells + (y1 / 2) * grid->cols;
+        for (uint32_t x = 0; x < pw; ++x) {
+            row[x].bottom = 0;
+        }
+    }
+
+    // Column sums of the Y plane or the packed rows, then of U and V
+    uint32_t luma_len = packed ? 4 * cw : w;
+    uint32_t len = luma_len + 2 * cw;
+    uint32_t* sums = Mem_alloc(len * sizeof(uint32_t));
+    if (sums == NULL) {
+        return false;
+    }
+    uint32_t* chroma = sums + luma_len;
+    for (uint32_t oy = y0; oy < y1; ++oy) {
+        uint32_t sy0 = oy * scale;
+        uint32_t sy1 = sy0 + scale < h ? sy0 + scale : h;
+        uint32_t rows = sy1 - sy0;
+        // Planar chroma has a row for every two rows of Y
+        uint32_t cy0 = packed ? sy0 : sy0 / 2;
+        uint32_t cy1 = packed ? sy1 : (sy1 - 1) / 2 + 1;
+        uint32_t chroma_rows = cy1 - cy0;
+        memset(sums, 0, len * sizeof(uint32_t));
+        for (uint32_t y = sy0; y < sy1; ++y) {
+            accumulate_row(sums, img->pixels + (size_t)y * img->pitch, luma_len);
+        }
+        for (uint32_t y = cy0; y < cy1 && !packed; ++y) {
+            const uint8_t* u = img->chroma[0] + (size_t)y * img->chroma_pitch;
+            if (format == RENDER_NV12) {
+                accumulate_row(chroma, u, 2 * cw);
+            } else {
+                const uint8_t* v = img->chroma[1] + (size_t)y * img->chroma_pitch;
+                accumulate_row(chroma, u, cw);
+                accumulate_row(chroma + cw, v, cw);
+            }
+        }
+
+        Cell* cell = grid->cells + (oy / 2) * grid->cols;
+        uint32_t half = oy & 1;
+        for (uint32_t ox = 0; ox < pw; ++ox, ++cell) {
+            uint32_t x0 = ox * scale;
+            uint32_t x1 = x0 + scale < w ? x0 + scale : w;
+            uint32_t c0 = x0 / 2;
+            uint32_t c1 = (x1 - 1) / 2 + 1;
+            uint32_t y = 0, u = 0, v = 0;
+            if (packed) {
+                for (uint32_t x = x0; x < x1; ++x) {
+                    y += sums[2 * x];
+                }
+                for (uint32_t c = c0; c < c1; ++c) {
+                    u += sums[4 * c + 1];
+                    v += sums[4 * c + 3];
+                }
+            } else {
+                for (uint32_t x = x0; x < x1; ++x) {
+                    y += sums[x];
+                }
+                for (uint32_t c = c0; c < c1; ++c) {
+                    if (format == RENDER_NV12) {
+                        u += chroma[2 * c];
+                        v += chroma[2 * c + 1];
+                    } else {
+                        u += chroma[c];
+                        v += chroma[cw + c];
+                    }
+                }
+            }
+            uint32_t n = x1 - x0;
+            uint32_t count = (c1 - c0) * chroma_rows;
+            y = n == scale ? block_average(y, rows, scale) : y / (n * rows);
+            store_yuv(cell, half, y, u / count, v / count);
+        }
+    }
+    Mem_free(sums);
+    return true;
+}
+
+typedef bool (*sample_fn)(const RenderImage* img, uint32_t scale, uint8_t* dest,
+                          CellGrid* grid, uint32_t y0, uint32_t y1, bool* opaque);
+
+#define SAMPLE_KERNEL(name, bpp, ri, gi, bi, ai, fixed_scale)                  \
+    static bool name(const RenderImage* img, uint32_t scale, uint8_t* dest,    \
+                     CellGrid* grid, uint32_t y0, uint32_t y1, bool* opaque) { \
+        return sample_kernel(img, scale, dest, grid, y0, y1, opaque, bpp, ri,  \
+                             gi, bi, ai, fixed_scale);                         \
+    }
+
+// Kernels for scales 1-4 and any other scale
+#define SAMPLE_KERNELS(name, bpp, ri, gi, bi, ai)                              \
+    SAMPLE_KERNEL(name##_any, bpp, ri, gi, bi, ai, 0)                          \
+    SAMPLE_KERNEL(name##_1, bpp, ri, gi, bi, ai, 1)                            \
+    SAMPLE_KERNEL(name##_2, bpp, ri, gi, bi, ai, 2)                            \
+    SAMPLE_KERNEL(name##_3, bpp, ri, gi, bi, ai, 3)                            \
+    SAMPLE_KERNEL(name##_4, bpp, ri, gi, bi, ai, 4)                            \
+    static const sample_fn name[5] = {                                         \
+        name##_any, name##_1, name##_2, name##_3, name##_4                     \
+    };
+
+SAMPLE_KERNELS(sample_rgba, 4, 0, 1, 2, 3)
+SAMPLE_KERNELS(sample_bgra, 4, 2, 1, 0, 3)
+SAMPLE_KERNELS(sample_rgbx, 4, 0, 1, 2, DOWNSAMPLE_NO_ALPHA)
+SAMPLE_KERNELS(sample_bgrx, 4, 2, 1, 0, DOWNSAMPLE_NO_ALPHA)
+SAMPLE_KERNELS(sample_bgr, 3, 2, 1, 0, DOWNSAMPLE_NO_ALPHA)
+
+#undef SAMPLE_KERNELS
+#undef SAMPLE_KERNEL
+
+#define YUV_KERNEL(name, format, fixed_scale)                                  \
+    static bool name(const RenderImage* img, uint32_t scale, uint8_t* dest,    \
+                     CellGrid* grid, uint32_t y0, uint32_t y1, bool* opaque) { \
+        (void)dest;                                                            \
+        *opaque = true;                                                        \
+        return yuv_kernel(img, scale, grid, y0, y1, format, fixed_scale);      \
+    }
+
+#define YUV_KERNELS(name, format)                                              \
+    YUV_KERNEL(name##_any, format, 0)                                          \
+    YUV_KERNEL(name##_1, format, 1)                                            \
+    YUV_KERNEL(name##_2, format, 2)                                            \
+    YUV_KERNEL(name##_3, format, 3)                                            \
+    YUV_KERNEL(name##_4, format, 4)                                            \
+    static const sample_fn name[5] = {                                         \
+        name##_any, name##_1, name##_2, name##_3, name##_4                     \
+    };
+
+YUV_KERNELS(sample_i420, RENDER_I420)
+YUV_KERNELS(sample_nv12, RENDER_NV12)
+YUV_KERNELS(sample_yuy2, RENDER_YUY2)
+
+#undef YUV_KERNELS
+#undef YUV_KERNEL
+
+// Any other layout
+static bool sample_generic(const RenderImage* img, uint32_t scale,
+                           uint8_t* dest, CellGrid* grid, uint32_t y0,
+                           uint32_t y1, bool* opaque) {
+    (void)grid;
+    *opaque = img->order[3] == DOWNSAMPLE_NO_ALPHA;
+    return downsample_rows(img->pixels, img->pitch, img->w, img->h, img->bpp,
+                           img->order, scale, dest, y0, y1);
+}
+
+// Layouts with their own kernels
+static const struct {
+    uint32_t format;
+    const sample_fn* kernels;
+} sample_formats[] = {
+    {RENDER_RGBA, sample_rgba},
+    {RENDER_BGRA, sample_bgra},
+    {RENDER_RGBX, sample_rgbx},
+    {RENDER_BGRX, sample_bgrx},
+    {RENDER_BGR, sample_bgr},
+};
+
+// YUV layouts, which are told apart by the format alone
+static const struct {
+    uint32_t format;
+    const sample_fn* kernels;
+} yuv_formats[] = {
+    {RENDER_I420, sample_i420},
+    {RENDER_NV12, sample_nv12},
+    {RENDER_YUY2, sample_yuy2},
+};
+
+// Kernel for `img` at `scale`. Sets `direct` if it fills the cells itself.
+static sample_fn select_kernel(const RenderImage* img, uint32_t scale,
+                               bool* direct) {
+    uint32_t yuv_count = sizeof(yuv_formats) / sizeof(yuv_formats[0]);
+    for (uint32_t i = 0; i < yuv_count; ++i) {
+        if (img->format == yuv_formats[i].format) {
+            *direct = true;
+            return yuv_formats[i].kernels[scale <= 4 ? scale : 0];
+        }
+    }
+    uint32_t count = sizeof(sample_formats) / sizeof(sample_formats[0]);
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t* f = formats[sample_formats[i].format];
+        if (img->bpp == f[0] && memcmp(img->order, f + 1, 4) == 0) {
+            *direct = f[4] == DOWNSAMPLE_NO_ALPHA;
+            return sample_formats[i].kernels[scale <= 4 ? scale : 0];
+        }
+    }
+    *direct = false;
+    return sample_generic;
+}
+
+typedef struct SampleJob {
+    const Renderer* r;
+    const RenderImage* img;
+    sample_fn kernel;
+    bool direct;
+    CellGrid* grid;
+    uint32_t band_rows;
+    bool failed;
+} SampleJob;
+
+// Downsample, blend and store the cell rows of band `ix` in the grid
+static void sample_band(void* arg, uint32_t ix) {
+    SampleJob* job = arg;
+    const Renderer* r = job->r;
+    const RenderImage* img = job->img;
+    CellGrid* grid = job->grid;
+    uint32_t rows = (img->h + r->scale - 1) / r->scale;
+    uint32_t y0 = ix * job->band_rows;
+    uint32_t y1 = y0 + job->band_rows < grid->rows ? y0 + job->band_rows : grid->rows;
+    uint32_t py0 = 2 * y0;
+    uint32_t py1 = 2 * y1 < rows ? 2 * y1 : rows;
+
+    // Images that turn out to be opaque skip blending
+    bool opaque;
+    if (!job->kernel(img, r->scale, r->pixels, grid, py0, py1, &opaque)) {
+        job->failed = true;
+        return;
+    }
+    if (!job->direct && !opaque) {
+        // Fully transparent pixels are not painted, so keep the alpha
+        // around
+        uint32_t count = grid->cols * (py1 - py0);
+        uint8_t* rgba = r->pixels + py0 * grid->cols * 4;
+        uint8_t* alpha = r->alpha + py0 * grid->cols;
+        for (uint32_t i = 0; i < count; ++i) {
+            alpha[i] = rgba[4 * i + 3];
+        }
+        blend_row(rgba, count, r->bg);
+    }
+    if (!job->direct) {
+        CellGrid_from_rgba_rows(grid, r->pixels, rows, y0, y1);
+    }
+    CellGrid_quantize_rows(grid, r->color_bits, y0, y1);
+    if (!opaque) {
+        CellGrid_mark_transparent_rows(grid, r->alpha, rows, y0, y1);
+    }
+}
+
+bool Renderer_sample(const Renderer* r, const RenderImage* img, CellGrid* grid) {
+    uint32_t rows = (img->h + r->scale - 1) / r->scale;
+    grid->cols = (img->w + r->scale - 1) / r->scale;
+    grid->rows = (rows + 1) / 2;
+    SampleJob job = {r, img, NULL, false, grid, grid->rows, false};
+    job.kernel = select_kernel(img, r->scale, &job.direct);
+    if (r->pool == NULL || grid->rows == 0) {
+        sample_band(&job, 0);
+    } else {
+        job.band_rows = (grid->rows + r->band_count - 1) / r->band_count;
+        uint32_t bands = (grid->rows + job.band_rows - 1) / job.band_rows;
+        WorkPool_run(r->pool, sample_band, &job, bands);
+    }
+    return !job.failed;
+}
+
+bool Renderer_encode(const Renderer* r, String* dest, const CellGrid* grid,
+                     const CellGrid* prev) {
+    if (r->pool != NULL) {
+        return encode_parallel(dest, grid, prev, r->pool, r->bands,
+                               r->band_count, &r->opts);
+    } else if (prev == NULL) {
+        return encode_frame(dest, grid, &r->opts);
+    }
+    return encode_delta(dest, grid, prev, &r->opts);
+}
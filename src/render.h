@@ -0,0 +1,107 @@
+#ifndef RENDER_H_00
+#define RENDER_H_00
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dynamic_string.h"
+#include "downsample.h"
+#include "encode.h"
+#include "workpool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Pixel layouts for RenderImage_from, named by the order of the bytes in
+// memory. X is a byte that is ignored.
+#define RENDER_RGBA 0
+#define RENDER_BGRA 1
+#define RENDER_ARGB 2
+#define RENDER_ABGR 3
+#define RENDER_RGBX 4
+#define RENDER_BGRX 5
+#define RENDER_XRGB 6
+#define RENDER_XBGR 7
+#define RENDER_RGB 8
+#define RENDER_BGR 9
+// YUV layouts, with BT.601 limited range colors as cameras deliver them.
+// I420 is a plane of Y followed by planes of U and V at half the width
+// and height, NV12 a plane of Y followed by one of interleaved U and V
+// at half the width and height. YUY2 packs two pixels into Y0 U Y1 V.
+#define RENDER_I420 10
+#define RENDER_NV12 11
+#define RENDER_YUY2 12
+#define RENDER_FORMATS 13
+
+// An image in memory, read by the render core. Rows are `pitch` bytes
+// apart and pixels `bpp` bytes, 3 or 4, or 1 and 2 for the Y plane of
+// planar and packed YUV.
+typedef struct RenderImage {
+    const uint8_t* pixels;
+    uint32_t w;
+    uint32_t h;
+    uint32_t pitch;
+    uint32_t bpp;
+    // Byte offsets of red, green, blue and alpha in a pixel. Alpha is
+    // DOWNSAMPLE_NO_ALPHA for opaque images.
+    uint8_t order[4];
+    // RENDER_ layout, RENDER_FORMATS if only described by `order`
+    uint32_t format;
+    // Planes of U and V of planar YUV, both pointing at the interleaved
+    // plane for NV12. Rows are `chroma_pitch` bytes apart.
+    const uint8_t* chroma[2];
+    uint32_t chroma_pitch;
+} RenderImage;
+
+// Describe the `w` x `h` image at `pixels` in one of the RENDER_ layouts.
+// The chroma planes of planar YUV follow the Y plane, with half its pitch
+// for I420 and the same pitch for NV12.
+RenderImage RenderImage_from(const void* pixels, uint32_t w, uint32_t h,
+                             uint32_t pitch, uint32_t format);
+
+// Turns images into escape sequences: downsamples, blends transparent
+// pixels, fills a CellGrid and encodes it. Shared by every executable.
+typedef struct Renderer {
+    // Every `scale` x `scale` block of the image is one half cell
+    uint32_t scale;
+    // Bits kept of each color channel
+    uint32_t color_bits;
+    EncodeOptions opts;
+    // Partly transparent pixels are blended onto this color
+    uint8_t bg[3];
+    // Downsampled RGBA image, one pixel per half cell, and its alpha
+    // before blending
+    uint8_t* pixels;
+    uint8_t* alpha;
+    // If not NULL, bands of rows are converted in parallel
+    WorkPool* pool;
+    String* bands;
+    uint32_t band_count;
+} Renderer;
+
+typedef Renderer Renderer_noinit;
+
+// Create a renderer for images of up to `cols` x `pixel_rows` pixels
+// after downsampling, at scale 1 keeping every color bit. If `pool` is not
+// NULL it is used for the conversion, it must outlive the renderer.
+bool Renderer_create(Renderer_noinit* r, uint32_t cols, uint32_t pixel_rows,
+                     WorkPool* pool);
+
+// Free the buffers of `r`, not the pool
+void Renderer_free(Renderer* r);
+
+// Downsample `img` and store its cells in `grid`, setting its size.
+// The grid must have room for them. YUV is averaged per half cell and
+// only the averages are converted to RGB.
+bool Renderer_sample(const Renderer* r, const RenderImage* img, CellGrid* grid);
+
+// Append escape sequences for `grid` to `dest`.
+// If `prev` is not NULL only cells that differ from it are painted.
+bool Renderer_encode(const Renderer* r, String* dest, const CellGrid* grid,
+                     const CellGrid* prev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "downsample.h"
+
+// Checks that every vectorized kernel produces the same bytes as the
+// scalar reference. Usage: test_downsample [seed] [iterations]
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+static uint32_t rng_range(uint32_t lo, uint32_t hi) {
+    return lo + rng() % (hi - lo + 1);
+}
+
+// Mostly uniform alpha, with extra weight on the fully transparent and
+// fully opaque values the kernels are most likely to get wrong
+static uint8_t rng_alpha(void) {
+    uint32_t r = rng() % 8;
+    if (r == 0) {
+        return 0;
+    }
+    if (r == 1) {
+        return 0xff;
+    }
+    return rng();
+}
+
+static void fill(uint8_t* buf, uint32_t size) {
+    for (uint32_t i = 0; i < size; ++i) {
+        buf[i] = rng();
+    }
+}
+
+static const char* const BACKENDS[] = {"sse2", "avx2", "neon"};
+
+static const uint8_t ORDERS[][4] = {
+    {0, 1, 2, 3},
+    {2, 1, 0, 3},
+    {1, 2, 3, 0},
+    {3, 2, 1, 0},
+    {0, 1, 2, DOWNSAMPLE_NO_ALPHA},
+    {2, 1, 0, DOWNSAMPLE_NO_ALPHA},
+};
+
+static uint32_t failures = 0;
+
+static void fail(const char* isa, const char* kernel, uint32_t iter,
+                 const char* fmt, uint32_t a, uint32_t b, uint32_t c) {
+    ++failures;
+    printf("%s %s mismatch at iteration %u: ", isa, kernel, iter);
+    printf(fmt, a, b, c);
+    printf("\n");
+}
+
+static void test_accumulate(const char* isa, uint32_t iter) {
+    uint32_t count = rng_range(0, 300);
+    uint32_t offset = rng_range(0, 31);
+    uint8_t* row = malloc(count + offset + 1);
+    uint32_t* ref = malloc((count + 1) * sizeof(uint32_t));
+    uint32_t* out = malloc((count + 1) * sizeof(uint32_t));
+    fill(row, count + offset + 1);
+    for (uint32_t i = 0; i <= count; ++i) {
+        ref[i] = rng() & 0xffffff;
+        out[i] = ref[i];
+    }
+    accumulate_row_scalar(ref, row + offset, count);
+    accumulate_row(out, row + offset, count);
+    for (uint32_t i = 0; i <= count; ++i) {
+        if (ref[i] != out[i]) {
+            fail(isa, "accumulate_row", iter, "count %u index %u offset %u",
+                 count, i, offset);
+            break;
+        }
+    }
+    free(row);
+    free(ref);
+    free(out);
+}
+
+static void test_blend(const char* isa, uint32_t iter) {
+    uint32_t count = rng_range(0, 200);
+    uint32_t offset = 4 * rng_range(0, 7);
+    uint32_t size = 4 * (count + 1) + offset;
+    uint8_t* ref = malloc(size);
+    uint8_t* out = malloc(size);
+    uint8_t bg[3] = {rng(), rng(), rng()};
+    fill(ref, size);
+    for (uint32_t i = offset + 3; i < size; i += 4) {
+        ref[i] = rng_alpha();
+    }
+    memcpy(out, ref, size);
+    blend_row_scalar(ref + offset, count, bg);
+    blend_row(out + offset, count, bg);
+    for (uint32_t i = 0; i < size; ++i) {
+        if (ref[i] != out[i]) {
+            fail(isa, "blend_row", iter, "count %u byte %u offset %u",
+                 count, i, offset);
+            break;
+        }
+    }
+    free(ref);
+    free(out);
+}
+
+static void test_downsample(const char* isa, uint32_t iter) {
+    uint32_t w = rng_range(1, 97);
+    uint32_t h = rng_range(1, 61);
+    uint32_t scale = rng_range(1, 5);
+    const uint8_t* order = ORDERS[rng() % (sizeof(ORDERS) / sizeof(ORDERS[0]))];
+    uint32_t bpp = order[3] == DOWNSAMPLE_NO_ALPHA ? 3 : 4;
+    uint32_t pitch = w * bpp + rng_range(0, 13);
+    uint32_t pw = (w + scale - 1) / scale;
+    uint32_t ph = (h + scale - 1) / scale;
+    uint32_t size = pw * ph * 4;
+
+    uint8_t* pixels = malloc(pitch * h);
+    uint8_t* ref = malloc(size);
+    uint8_t* out = malloc(size);
+    fill(pixels, pitch * h);
+    if (bpp == 4) {
+        for (uint32_t y = 0; y < h; ++y) {
+            for (uint32_t x = 0; x < w; ++x) {
+                pixels[y * pitch + x * 4 + order[3]] = rng_alpha();
+            }
+        }
+    }
+    memset(ref, 0, size);
+    memset(out, 0, size);
+
+    downsample_select("scalar");
+    bool ok = downsample_rows(pixels, pitch, w, h, bpp, order, scale, ref, 0, ph);
+    downsample_select(isa);
+    ok = downsample_rows(pixels, pitch, w, h, bpp, order, scale, out, 0, ph) && ok;
+    if (!ok) {
+        fail(isa, "downsample_rows", iter, "%ux%u scale %u failed", w, h, scale);
+    } else {
+        for (uint32_t i = 0; i < size; ++i) {
+            if (ref[i] != out[i]) {
+                fail(isa, "downsample_rows", iter, "%ux%u scale %u", w, h, scale);
+                break;
+            }
+        }
+    }
+    free(pixels);
+    free(ref);
+    free(out);
+}
+
+int main(int argc, char** argv) {
+    uint32_t seed = argc > 1 ? strtoul(argv[1], NULL, 10) : 1;
+    uint32_t iterations = argc > 2 ? strtoul(argv[2], NULL, 10) : 2000;
+    rng_state = seed == 0 ? 1 : seed;
+
+    printf("default: %s\n", downsample_init());
+    uint32_t tested = 0;
+    for (uint32_t b = 0; b < sizeof(BACKENDS) / sizeof(BACKENDS[0]); ++b) {
+        const char* isa = BACKENDS[b];
+        if (downsample_select(isa) == NULL) {
+            printf("%s: not available\n", isa);
+            continue;
+        }
+        uint32_t before = failures;
+        for (uint32_t i = 0; i < iterations; ++i) {
+            downsample_select(isa);
+            test_accumulate(isa, i);
+            test_blend(isa, i);
+            test_downsample(isa, i);
+        }
+        printf("%s: %u iterations, %u mismatches\n", isa, iterations,
+               failures - before);
+        ++tested;
+    }
+    if (tested == 0) {
+        printf("no vectorized kernels in this build\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
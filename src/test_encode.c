@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "encode.h"
+#include "palette.h"
+
+// Encodes mostly transparent grids with EncodeOptions.blank set and checks
+// that the cursor moves over the fully transparent cells with CUF instead
+// of painting them, while every other cell is still painted. Exits
+// non-zero if any case fails.
+
+#define COLS 40
+#define ROWS 6
+
+static uint32_t failures = 0;
+
+static uint32_t parse_uint(const char** s) {
+    uint32_t n = 0;
+    while (**s >= '0' && **s <= '9') {
+        n = n * 10 + (uint32_t)(**s - '0');
+        ++*s;
+    }
+    return n;
+}
+
+// Opaque runs of 5 cells moving along the rows, with the cell after each
+// run only transparent in its bottom half
+static void fill_grid(CellGrid* grid) {
+    for (uint32_t y = 0; y < ROWS; ++y) {
+        for (uint32_t x = 0; x < COLS; ++x) {
+            Cell* c = grid->cells + y * COLS + x;
+            uint32_t run = (x / 5 + y) % 4;
+            uint32_t color = CELL_RGB(40 * y, 6 * x, 100);
+            c->top = run == 0 || (run == 1 && x % 5 == 0) ? color : CELL_TRANSPARENT;
+            c->bottom = run == 0 ? color : CELL_TRANSPARENT;
+        }
+    }
+}
+
+// Mark the cells the output of encode_frame writes to. Returns the number
+// of CUF sequences in it.
+static uint32_t decode(const char* s, bool* painted) {
+    uint32_t row = 0, col = 0, cuf = 0;
+    memset(painted, 0, sizeof(bool) * COLS * ROWS);
+    while (*s != '\0') {
+        if (*s == '\x1b') {
+            s += 2;
+            const char* params = s;
+            while ((*s >= '0' && *s <= '9') || *s == ';') {
+                ++s;
+            }
+            char cmd = *s++;
+            uint32_t n = parse_uint(&params);
+            if (cmd == 'H') {
+                row = n - 1;
+                ++params;
+                col = parse_uint(&params) - 1;
+            } else if (cmd == 'C') {
+                col += n;
+                ++cuf;
+            } else if (cmd == 'K') {
+                for (uint32_t x = col; row < ROWS && x < COLS; ++x) {
+                    painted[row * COLS + x] = true;
+                }
+            } else if (cmd == 'b') {
+                for (uint32_t i = 0; i < n && row < ROWS && col < COLS; ++i, ++col) {
+                    painted[row * COLS + col] = true;
+                }
+            }
+            continue;
+        }
+        if (*s == '\n') {
+            ++row;
+            col = 0;
+            ++s;
+            continue;
+        }
+        // A space or a 3 byte block element
+        s += *s == ' ' ? 1 : 3;
+        if (row < ROWS && col < COLS) {
+            painted[row * COLS + col] = true;
+        }
+        ++col;
+    }
+    return cuf;
+}
+
+static void run(const char* name, const CellGrid* grid, const EncodeOptions* opts) {
+    String out;
+    bool painted[COLS * ROWS];
+    if (!String_create(&out) || !encode_frame(&out, grid, opts)) {
+        printf("Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t cuf = decode(out.buffer, painted);
+    uint32_t bad = 0;
+    for (uint32_t i = 0; i < COLS * ROWS; ++i) {
+        const Cell* c = grid->cells + i;
+        bool blank = c->top == CELL_TRANSPARENT && c->bottom == CELL_TRANSPARENT;
+        if (painted[i] == blank) {
+            ++bad;
+        }
+    }
+    if (cuf == 0 || bad > 0) {
+        ++failures;
+        printf("%s: %u CUF, %u cells wrongly painted or skipped\n", name, cuf, bad);
+    }
+    String_free(&out);
+}
+
+int main(void) {
+    CellGrid grid;
+    if (!CellGrid_create(&grid, COLS, ROWS)) {
+        printf("Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    palette_init();
+    fill_grid(&grid);
+
+    static const char* const MODES[3] = {"truecolor", "256", "16"};
+    for (uint32_t colors = ENCODE_TRUECOLOR; colors <= ENCODE_16; ++colors) {
+        for (uint32_t variant = 0; variant < 16; ++variant) {
+            EncodeOptions opts = {0};
+            opts.blank = true;
+            opts.colors = colors;
+            opts.repeat = variant & 1;
+            opts.has_default_bg = variant & 2;
+            opts.tolerance = variant & 4 ? 8 : 0;
+            opts.greedy = variant & 8;
+            char name[64];
+            snprintf(name, sizeof(name), "%s%s%s%s%s", MODES[colors],
+                     opts.repeat ? " repeat" : "",
+                     opts.has_default_bg ? " default bg" : "",
+                     opts.tolerance ? " tolerance" : "",
+                     opts.greedy ? " greedy" : "");
+            run(name, &grid, &opts);
+        }
+    }
+
+    CellGrid_free(&grid);
+    if (failures == 0) {
+        printf("All cases passed\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hysteresis.h"
+
+// Feeds sequences of colors to a one cell grid and checks which colors
+// Hysteresis_apply lets through. Exits non-zero if any case fails.
+
+#define THRESHOLD 4
+#define FRAMES 3
+
+static uint32_t failures = 0;
+
+static uint32_t gray(uint8_t v) {
+    return CELL_RGB(v, v, v);
+}
+
+// Run `count` frames whose top half is `colors[i]` through a new filter,
+// starting from `start` on screen, and compare what is shown after each
+// frame with `want`
+static void run(const char* name, uint32_t start, const uint32_t* colors,
+                const uint32_t* want, uint32_t count) {
+    Hysteresis h;
+    CellGrid shown, grid;
+    if (!Hysteresis_create(&h, 1, 1, THRESHOLD, FRAMES) ||
+        !CellGrid_create(&shown, 1, 1) || !CellGrid_create(&grid, 1, 1)) {
+        printf("Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    shown.cells[0].top = start;
+    shown.cells[0].bottom = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        grid.cells[0].top = colors[i];
+        grid.cells[0].bottom = 0;
+        Hysteresis_apply(&h, &grid, &shown);
+        if (grid.cells[0].top != want[i]) {
+            ++failures;
+            printf("%s: frame %u shows %06x, expected %06x\n", name, i,
+                   grid.cells[0].top, want[i]);
+            break;
+        }
+        shown.cells[0] = grid.cells[0];
+    }
+    Hysteresis_free(&h);
+    CellGrid_free(&shown);
+    CellGrid_free(&grid);
+}
+
+int main(void) {
+    uint32_t s = gray(100);
+
+    // Noise around the shown color keeps turning, so it never adds up
+    uint32_t noise[12];
+    uint32_t noise_want[12];
+    for (uint32_t i = 0; i < 12; ++i) {
+        noise[i] = gray(i & 1 ? 98 : 102);
+        noise_want[i] = s;
+    }
+    run("noise", s, noise, noise_want, 12);
+
+    // A small change that stays shows after FRAMES frames
+    uint32_t steady[] = {gray(102), gray(102), gray(102), gray(102)};
+    uint32_t steady_want[] = {s, s, gray(102), gray(102)};
+    run("steady", s, steady, steady_want, 4);
+
+    // A change drifting in one direction counts as one change
+    uint32_t drift[] = {gray(101), gray(102), gray(103)};
+    uint32_t drift_want[] = {s, s, gray(103)};
+    run("drift", s, drift, drift_want, 3);
+
+    // Turning around starts the count over
+    uint32_t flip[] = {gray(102), gray(102), gray(98), gray(98), gray(98)};
+    uint32_t flip_want[] = {s, s, s, s, gray(98)};
+    run("flip", s, flip, flip_want, 5);
+
+    // Turning in one channel is enough
+    uint32_t channel[] = {CELL_RGB(102, 102, 100), CELL_RGB(102, 102, 100),
+                          CELL_RGB(102, 98, 100), CELL_RGB(102, 98, 100),
+                          CELL_RGB(102, 98, 100)};
+    uint32_t channel_want[] = {s, s, s, s, CELL_RGB(102, 98, 100)};
+    run("channel", s, channel, channel_want, 5);
+
+    // Going back to the shown color starts over
+    uint32_t back[] = {gray(102), gray(102), s, gray(102), gray(102), gray(102)};
+    uint32_t back_want[] = {s, s, s, s, s, gray(102)};
+    run("back", s, back, back_want, 6);
+
+    // A change over the threshold shows at once, and small changes from
+    // there count from the start
+    uint32_t jump[] = {gray(102), gray(102), gray(110), gray(112), gray(112),
+                       gray(112)};
+    uint32_t jump_want[] = {s, s, gray(110), gray(110), gray(110), gray(112)};
+    run("jump", s, jump, jump_want, 6);
+
+    // Transparency always shows at once
+    uint32_t clear[] = {gray(102), CELL_TRANSPARENT, gray(100)};
+    uint32_t clear_want[] = {s, CELL_TRANSPARENT, gray(100)};
+    run("transparent", s, clear, clear_want, 3);
+
+    if (failures == 0) {
+        printf("All cases passed\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
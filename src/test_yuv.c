@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "render.h"
+
+// Checks Renderer_sample on I420, NV12 and YUY2 images against a naive
+// conversion, for odd sizes, padded pitches and scales 1 to 4.
+// Usage: test_yuv [seed] [iterations]
+//
+// Random images must match averaging Y over each block and U and V over
+// the chroma samples covering it, then converting once, exactly. Smooth
+// images, where that matches converting each pixel, must stay within
+// SMOOTH_TOLERANCE of converting every pixel and averaging the colors.
+
+#define SMOOTH_TOLERANCE 3
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+static uint32_t rng_range(uint32_t lo, uint32_t hi) {
+    return lo + rng() % (hi - lo + 1);
+}
+
+static const char* const FORMAT_NAMES[3] = {"I420", "NV12", "YUY2"};
+
+// The planes of a test image, one U and V sample for every two pixels of
+// a row, and for every two rows unless packed
+typedef struct Planes {
+    uint8_t* y;
+    uint8_t* u;
+    uint8_t* v;
+    uint32_t w;
+    uint32_t h;
+    uint32_t cw;
+    uint32_t ch;
+} Planes;
+
+static uint8_t clamp(int32_t v) {
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+}
+
+// BT.601 limited range to RGB
+static void to_rgb(int32_t y, int32_t u, int32_t v, int32_t rgb[3]) {
+    int32_t c = 298 * (y - 16) + 128;
+    int32_t d = u - 128;
+    int32_t e = v - 128;
+    rgb[0] = clamp((c + 409 * e) >> 8);
+    rgb[1] = clamp((c - 100 * d - 208 * e) >> 8);
+    rgb[2] = clamp((c + 516 * d) >> 8);
+}
+
+static uint8_t triangle(uint32_t t) {
+    t %= 80;
+    return t < 40 ? t : 80 - t;
+}
+
+// Random planes, or smooth chroma that steps by at most 3 between
+// samples, with every color inside the RGB gamut
+static void fill_planes(Planes* p, bool smooth) {
+    for (uint32_t i = 0; i < p->w * p->h; ++i) {
+        p->y[i] = smooth ? rng_range(60, 170) : rng_range(16, 235);
+    }
+    for (uint32_t cy = 0; cy < p->ch; ++cy) {
+        for (uint32_t cx = 0; cx < p->cw; ++cx) {
+            uint32_t i = cy * p->cw + cx;
+            if (smooth) {
+                p->u[i] = 110 + triangle(cx + 2 * cy);
+                p->v[i] = 110 + triangle(3 * cx + cy + 20);
+            } else {
+                p->u[i] = rng_range(16, 240);
+                p->v[i] = rng_range(16, 240);
+            }
+        }
+    }
+}
+
+// Lay the planes out in `format` with rows `pitch` bytes apart. Returns
+// the buffer, with random bytes in the padding.
+static uint8_t* pack(const Planes* p, uint32_t format, uint32_t pitch) {
+    size_t size = (size_t)pitch * p->h;
+    if (format == RENDER_I420) {
+        size += (size_t)2 * ((pitch + 1) / 2) * p->ch;
+    } else if (format == RENDER_NV12) {
+        size += (size_t)pitch * p->ch;
+    }
+    uint8_t* buf = malloc(size);
+    if (buf == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        buf[i] = rng();
+    }
+    if (format == RENDER_YUY2) {
+        // An odd width leaves the second Y of the last pair unused
+        for (uint32_t y = 0; y < p->h; ++y) {
+            for (uint32_t cx = 0; cx < p->cw; ++cx) {
+                uint8_t* px = buf + (size_t)y * pitch + 4 * cx;
+                px[0] = p->y[y * p->w + 2 * cx];
+                px[1] = p->u[y * p->cw + cx];
+                if (2 * cx + 1 < p->w) {
+                    px[2] = p->y[y * p->w + 2 * cx + 1];
+                }
+                px[3] = p->v[y * p->cw + cx];
+            }
+        }
+        return buf;
+    }
+    for (uint32_t y = 0; y < p->h; ++y) {
+        memcpy(buf + (size_t)y * pitch, p->y + y * p->w, p->w);
+    }
+    uint8_t* chroma = buf + (size_t)pitch * p->h;
+    for (uint32_t cy = 0; cy < p->ch; ++cy) {
+        for (uint32_t cx = 0; cx < p->cw; ++cx) {
+            uint32_t i = cy * p->cw + cx;
+            if (format == RENDER_NV12) {
+                chroma[(size_t)cy * pitch + 2 * cx] = p->u[i];
+                chroma[(size_t)cy * pitch + 2 * cx + 1] = p->v[i];
+            } else {
+                uint32_t cp = (pitch + 1) / 2;
+                chroma[(size_t)cy * cp + cx] = p->u[i];
+                chroma[(size_t)cp * p->ch + (size_t)cy * cp + cx] = p->v[i];
+            }
+        }
+    }
+    return buf;
+}
+
+static uint32_t failures = 0;
+static uint32_t max_smooth_error = 0;
+
+// Compare the half cells of `grid` with the naive conversion of `p`
+static void check(const Planes* p, const CellGrid* grid, uint32_t format,
+                  uint32_t scale, bool smooth, uint32_t pitch) {
+    bool packed = format == RENDER_YUY2;
+    uint32_t pw = (p->w + scale - 1) / scale;
+    uint32_t ph = (p->h + scale - 1) / scale;
+    uint32_t bad = 0;
+    for (uint32_t oy = 0; oy < ph; ++oy) {
+        for (uint32_t ox = 0; ox < pw; ++ox) {
+            uint32_t x0 = ox * scale, y0 = oy * scale;
+            uint32_t x1 = x0 + scale < p->w ? x0 + scale : p->w;
+            uint32_t y1 = y0 + scale < p->h ? y0 + scale : p->h;
+            uint32_t ys = 0, us = 0, vs = 0, n = 0, cn = 0;
+            int32_t sum[3] = {0, 0, 0};
+            for (uint32_t y = y0; y < y1; ++y) {
+                uint32_t cy = packed ? y : y / 2;
+                for (uint32_t x = x0; x < x1; ++x) {
+                    uint32_t ci = cy * p->cw + x / 2;
+                    int32_t rgb[3];
+                    to_rgb(p->y[y * p->w + x], p->u[ci], p->v[ci], rgb);
+                    for (uint32_t k = 0; k < 3; ++k) {
+                        sum[k] += rgb[k];
+                    }
+                    ys += p->y[y * p->w + x];
+                    ++n;
+                }
+            }
+            uint32_t cy0 = packed ? y0 : y0 / 2;
+            uint32_t cy1 = packed ? y1 : (y1 - 1) / 2 + 1;
+            for (uint32_t cy = cy0; cy < cy1; ++cy) {
+                for (uint32_t cx = x0 / 2; cx <= (x1 - 1) / 2; ++cx) {
+                    us += p->u[cy * p->cw + cx];
+                    vs += p->v[cy * p->cw + cx];
+                    ++cn;
+                }
+            }
+
+            const Cell* c = grid->cells + (oy / 2) * grid->cols + ox;
+            uint32_t got = oy & 1 ? c->bottom : c->top;
+            int32_t want[3];
+            to_rgb(ys / n, us / cn, vs / cn, want);
+            if (got != CELL_RGB(want[0], want[1], want[2])) {
+                ++bad;
+            }
+            if (smooth) {
+                for (uint32_t k = 0; k < 3; ++k) {
+                    int32_t d = (int32_t)((got >> (8 * k)) & 0xff) -
+                                sum[k] / (int32_t)n;
+                    uint32_t e = d < 0 ? -d : d;
+                    if (e > max_smooth_error) {
+                        max_smooth_error = e;
+                    }
+                    if (e > SMOOTH_TOLERANCE) {
+                        ++bad;
+                    }
+                }
+            }
+        }
+    }
+    if (ph & 1) {
+        const Cell* row = grid->cells + (ph / 2) * grid->cols;
+        for (uint32_t x = 0; x < pw; ++x) {
+            if (row[x].bottom != 0) {
+                ++bad;
+            }
+        }
+    }
+    if (bad > 0) {
+        ++failures;
+        printf("%s %ux%u pitch %u scale %u%s: %u mismatches\n",
+               FORMAT_NAMES[format - RENDER_I420], p->w, p->h, pitch, scale,
+               smooth ? " smooth" : "", bad);
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t seed = argc > 1 ? strtoul(argv[1], NULL, 10) : 1;
+    uint32_t iterations = argc > 2 ? strtoul(argv[2], NULL, 10) : 200;
+    rng_state = seed == 0 ? 1 : seed;
+    downsample_init();
+    WorkPool* pool = WorkPool_create(4);
+
+    uint32_t tests = 0;
+    for (uint32_t i = 0; i < iterations; ++i) {
+        Planes p;
+        p.w = rng_range(1, 67);
+        p.h = rng_range(1, 53);
+        p.cw = (p.w + 1) / 2;
+        bool smooth = i & 1;
+        for (uint32_t format = RENDER_I420; format <= RENDER_YUY2; ++format) {
+            p.ch = format == RENDER_YUY2 ? p.h : (p.h + 1) / 2;
+            p.y = malloc(p.w * p.h);
+            p.u = malloc(p.cw * p.ch);
+            p.v = malloc(p.cw * p.ch);
+            if (p.y == NULL || p.u == NULL || p.v == NULL) {
+                printf("Out of memory\n");
+                return EXIT_FAILURE;
+            }
+            fill_planes(&p, smooth);
+            // NV12 and YUY2 rows hold whole pairs of pixels
+            uint32_t min_pitch = format == RENDER_I420 ? p.w :
+                                 format == RENDER_NV12 ? 2 * p.cw : 4 * p.cw;
+            uint32_t pitch = min_pitch + (rng() & 1 ? rng_range(1, 17) : 0);
+            uint8_t* buf = pack(&p, format, pitch);
+            if (buf == NULL) {
+                printf("Out of memory\n");
+                return EXIT_FAILURE;
+            }
+            RenderImage img = RenderImage_from(buf, p.w, p.h, pitch, format);
+
+            for (uint32_t scale = 1; scale <= 4; ++scale) {
+                uint32_t pw = (p.w + scale - 1) / scale;
+                uint32_t ph = (p.h + scale - 1) / scale;
+                for (uint32_t threads = 0; threads < 2; ++threads) {
+                    Renderer r;
+                    CellGrid grid;
+                    if (!Renderer_create(&r, pw, ph, threads ? pool : NULL) ||
+                        !CellGrid_create(&grid, pw, (ph + 1) / 2)) {
+                        printf("Out of memory\n");
+                        return EXIT_FAILURE;
+                    }
+                    r.scale = scale;
+                    memset(grid.cells, 0xab, sizeof(Cell) * grid.cols * grid.rows);
+                    if (!Renderer_sample(&r, &img, &grid)) {
+                        ++failures;
+                        printf("Renderer_sample failed\n");
+                    } else {
+                        check(&p, &grid, format, scale, smooth, pitch);
+                    }
+                    ++tests;
+                    CellGrid_free(&grid);
+                    Renderer_free(&r);
+                }
+            }
+            free(buf);
+            free(p.y);
+            free(p.u);
+            free(p.v);
+        }
+    }
+    printf("%u images, %u failed, largest error on smooth images %u\n",
+           tests, failures, max_smooth_error);
+    if (pool != NULL) {
+        WorkPool_free(pool);
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,184 @@
+#include "workpool.h"
+#include "mem.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+#define mutex_init(m) InitializeCriticalSection(m)
+#define mutex_destroy(m) DeleteCriticalSection(m)
+#define mutex_lock(m) EnterCriticalSection(m)
+#define mutex_unlock(m) LeaveCriticalSection(m)
+#define cond_init(c) InitializeConditionVariable(c)
+#define cond_destroy(c)
+#define cond_wait(c, m) SleepConditionVariableCS(c, m, INFINITE)
+#define cond_broadcast(c) WakeAllConditionVariable(c)
+#else
+#include <pthread.h>
+#include <unistd.h>
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+#define mutex_init(m) pthread_mutex_init(m, NULL)
+#define mutex_destroy(m) pthread_mutex_destroy(m)
+#define mutex_lock(m) pthread_mutex_lock(m)
+#define mutex_unlock(m) pthread_mutex_unlock(m)
+#define cond_init(c) pthread_cond_init(c, NULL)
+#define cond_destroy(c) pthread_cond_destroy(c)
+#define cond_wait(c, m) pthread_cond_wait(c, m)
+#define cond_broadcast(c) pthread_cond_broadcast(c)
+#endif
+
+struct WorkPool {
+    mutex_t lock;
+    cond_t work_ready;
+    cond_t work_done;
+
+    work_fn fn;
+    void* arg;
+    uint32_t next;
+    uint32_t count;
+    uint32_t finished;
+    // Incremented for every WorkPool_run, so workers can tell new work
+    // from the job they just finished.
+    uint64_t generation;
+    bool quit;
+
+    uint32_t thread_count;
+    thread_t threads[];
+};
+
+uint32_t WorkPool_cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+#endif
+}
+
+// Run jobs until all indices of the current generation are handed out.
+// Called with the lock held.
+static void work(WorkPool* pool) {
+    while (pool->next < pool->count) {
+        uint32_t ix = pool->next++;
+        work_fn fn = pool->fn;
+        void* arg = pool->arg;
+        mutex_unlock(&pool->lock);
+        fn(arg, ix);
+        mutex_lock(&pool->lock);
+        if (++pool->finished == pool->count) {
+            cond_broadcast(&pool->work_done);
+        }
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker(void* arg) {
+#else
+static void* worker(void* arg) {
+#endif
+    WorkPool* pool = arg;
+    uint64_t generation = 0;
+    mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->quit && pool->generation == generation) {
+            cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->quit) {
+            break;
+        }
+        generation = pool->generation;
+        work(pool);
+    }
+    mutex_unlock(&pool->lock);
+    return 0;
+}
+
+WorkPool* WorkPool_create(uint32_t threads) {
+    if (threads == 0) {
+        threads = WorkPool_cpu_count();
+    }
+    // The thread calling WorkPool_run also runs jobs
+    uint32_t count = threads - 1;
+    WorkPool* pool = Mem_alloc(sizeof(WorkPool) + count * sizeof(thread_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    mutex_init(&pool->lock);
+    cond_init(&pool->work_ready);
+    cond_init(&pool->work_done);
+    pool->fn = NULL;
+    pool->arg = NULL;
+    pool->next = 0;
+    pool->count = 0;
+    pool->finished = 0;
+    pool->generation = 0;
+    pool->quit = false;
+    pool->thread_count = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+#ifdef _WIN32
+        HANDLE t = CreateThread(NULL, 0, worker, pool, 0, NULL);
+        if (t == NULL) {
+            break;
+        }
+        pool->threads[i] = t;
+#else
+        if (pthread_create(&pool->threads[i], NULL, worker, pool) != 0) {
+            break;
+        }
+#endif
+        ++pool->thread_count;
+    }
+    return pool;
+}
+
+void WorkPool_free(WorkPool* pool) {
+    if (pool == NULL) {
+        return;
+    }
+    mutex_lock(&pool->lock);
+    pool->quit = true;
+    cond_broadcast(&pool->work_ready);
+    mutex_unlock(&pool->lock);
+    for (uint32_t i = 0; i < pool->thread_count; ++i) {
+#ifdef _WIN32
+        WaitForSingleObject(pool->threads[i], INFINITE);
+        CloseHandle(pool->threads[i]);
+#else
+        pthread_join(pool->threads[i], NULL);
+#endif
+    }
+    cond_destroy(&pool->work_ready);
+    cond_destroy(&pool->work_done);
+    mutex_destroy(&pool->lock);
+    Mem_free(pool);
+}
+
+uint32_t WorkPool_size(const WorkPool* pool) {
+    return pool->thread_count + 1;
+}
+
+void WorkPool_run(WorkPool* pool, work_fn fn, void* arg, uint32_t count) {
+    if (count == 0) {
+        return;
+    }
+    mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->next = 0;
+    pool->count = count;
+    pool->finished = 0;
+    ++pool->generation;
+    cond_broadcast(&pool->work_ready);
+    work(pool);
+    while (pool->finished < pool->count) {
+        cond_wait(&pool->work_done, &pool->lock);
+    }
+    mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,37 @@
+#ifndef WORKPOOL_H_00
+#define WORKPOOL_H_00
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Job called once for every index passed to WorkPool_run
+typedef void (*work_fn)(void* arg, uint32_t ix);
+
+typedef struct WorkPool WorkPool;
+
+// Number of logical cpus
+uint32_t WorkPool_cpu_count(void);
+
+// Create a pool running jobs on `threads` threads, including the caller
+// of WorkPool_run. 0 means one per logical cpu.
+WorkPool* WorkPool_create(uint32_t threads);
+
+// Stop and free a pool
+void WorkPool_free(WorkPool* pool);
+
+// Number of threads running jobs
+uint32_t WorkPool_size(const WorkPool* pool);
+
+// Call `fn(arg, ix)` for every `ix` in [0, count), spread over the pool.
+// Indices are handed out in order as threads become free.
+// Returns when all calls are done. Must not be called from inside a job.
+void WorkPool_run(WorkPool* pool, work_fn fn, void* arg, uint32_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif